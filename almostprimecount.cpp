@@ -33,11 +33,16 @@
 #include <iomanip>
 #include <utility>
 #include <vector>
-#include <deque>
-#include <map>
-#include <list>
+#include <set>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
 
 #include "primegen.hpp"
+#include "multiplicative_sieve.hpp"
 #include "program_options.hpp"
 
 namespace pg = primegen;
@@ -49,7 +54,7 @@ namespace primegen
 // A k-almost prime counter for < 2^n
 // Works like the sieve of Eratosthenes, except:
 // - for every integer we keep a factor counter and a cumulative product
-// - every prime and its powers 'walk' over the sieve and increase the counter
+// - every prime and its powers 'walk' over the sieve and increase the counter, see prime_walker
 // - if we 'walk' every prime < sqrt(2^n) then there can be at most 1 prime factor >= sqrt(2^n)
 //   to check this we compare the final cumulative product with the actual integer (equal <=> "no prime factor >= sqrt(2^n)")
 
@@ -60,13 +65,22 @@ public:
     typedef std::uint8_t count_t; // used to count number of prime factors k: 8 bits: 0 <= k < 256
     typedef std::size_t size_t;
 
-#define segment_size (1ULL<<16)
+    static const size_t segment_size = prime_walker<true>::segment_size;
+
+    enum output_format_t { format_text, format_json, format_csv };
 
 private:
     size_t _maxbits, _maxval, _sqrtmaxval;
+    output_format_t _format;
+    double _progressinterval; // seconds between progress reports, 0 = disabled
+    std::ostream* _status;
+
+    std::ostream& status() { return *_status; }
 public:
-    almost_prime_sieve(size_t maxbits)
-        : _maxbits(maxbits)
+    // status messages go to statusstream, by default stdout for text output and stderr to keep json & csv output clean
+    almost_prime_sieve(size_t maxbits, output_format_t format = format_text, double progressinterval = 0, std::ostream* statusstream = nullptr)
+        : _maxbits(maxbits), _format(format), _progressinterval(progressinterval)
+        , _status(statusstream != nullptr ? statusstream : (format == format_text ? &std::cout : &std::cerr))
     {
         _maxval = (1ULL << _maxbits);
         _sqrtmaxval = ceil_sqrt(_maxval);
@@ -74,231 +88,405 @@ public:
             throw std::runtime_error("maxbits too small");
     }
 
-private:
-    std::vector<integer_t> _primecache;
-public:
-    void prepare_primecache()
-    {
-        _primecache.clear();
-        std::cout << "Computing set of primes p < " << _sqrtmaxval << "..." << std::endl;
-        prime_sieve ps;
-        ps.genprimes(2, _sqrtmaxval, [&](size_t p){ _primecache.emplace_back(p); });
-        std::cout << "Largest prime: " << _primecache.back() << std::endl;
-    }
-
 private:
     std::vector< std::vector<size_t> > interval_counts_odd;
     std::vector< std::vector<size_t> > interval_counts;
-    std::vector< count_t > count;
-    std::vector< integer_t > factor;
+    std::vector< count_t, sieve_allocator<count_t> > count;
+    std::vector< integer_t, sieve_allocator<integer_t> > factor;
+    // with Factors: the walked prime factors of each integer of the current segment as linked lists
+    // factorhead[i]-1 is the index of the first entry in factorprime, as multiplicative_sieve::segment_t
+    std::vector< std::uint32_t > factorhead, factornext, factorprime;
 
-    struct prime_t 
+    inline void addfactor(size_t i, std::uint32_t p)
     {
-        prime_t(const prime_t&) = default;
-        prime_t& operator= (const prime_t&) = default;
-        prime_t (integer_t _p = 0, integer_t _n = 0)
-            : p(_p), n(_n)
-        {}
-        integer_t p, n;
-    };
-    struct primepower_t
+        factorprime.emplace_back(p);
+        factornext.emplace_back(factorhead[i]);
+        factorhead[i] = std::uint32_t(factorprime.size());
+    }
+
+    // walked prime (powers) dividing the integer with index i of the current segment
+    // the buffers are held as raw pointers, so that the walk keeps them in registers
+    template<bool Factors>
+    struct hit_t
     {
-        primepower_t(const primepower_t&) = default;
-        primepower_t& operator= (const primepower_t&) = default;
-        primepower_t(integer_t _p = 0, integer_t _q = 0, integer_t _n = 0)
-            : p(_p), q(_q), n(_n)
+        count_t* count;
+        integer_t* factor;
+        almost_prime_sieve* s;
+
+        hit_t(almost_prime_sieve& _s)
+            : count(_s.count.data()), factor(_s.factor.data()), s(&_s)
         {}
-        integer_t p, q, n;
+
+        inline void prime(size_t i, integer_t p) const
+        {
+            ++count[i];
+            factor[i] *= p;
+            if (Factors) s->addfactor(i, std::uint32_t(p));
+        }
+        // prime power q = p^k with k > 1 divides the integer
+        inline void power(size_t i, integer_t p) const
+        {
+            prime(i, p);
+        }
     };
-    
-    inline void count_prime(size_t offset, prime_t& p)
+
+    // presieve: the smallest odd primes are not walked over the sieve
+    // instead their combined count & factor pattern is precomputed once and copied into each segment
+    // the pattern is periodic in the sieve index with period the product of the presieve primes
+    // sieves over odd integers only use index i for n = offset + 2i + 1, sieves over all integers index i for n = offset + i
+    const integer_t _presieveprimes[5] = { 3, 5, 7, 11, 13 };
+    std::vector< count_t, sieve_allocator<count_t> > _presieve_count;
+    std::vector< integer_t, sieve_allocator<integer_t> > _presieve_factor;
+    bool _presieve_odd;
+
+    void make_presieve(bool odd)
     {
-        if (p.n < offset || p.n >= offset+segment_size)
-            throw std::runtime_error("count_prime: out of range");
-        size_t i = (p.n - offset)/2;
-        for (; i < segment_size/2; i += p.p)
+        if (!_presieve_count.empty() && _presieve_odd == odd)
+            return;
+        _presieve_odd = odd;
+        size_t period = 1;
+        for (auto p : _presieveprimes)
+            period *= p;
+        _presieve_count.assign(period, 0);
+        _presieve_factor.assign(period, 1);
+        for (auto p : _presieveprimes)
         {
-            ++count[i];
-            factor[i] *= p.p;
+            // odd multiples n = 2i+1 of p: i = (p-1)/2 + j*p, any multiple n = i of p: i = j*p
+            for (size_t i = odd ? (p-1)/2 : 0; i < period; i += p)
+            {
+                ++_presieve_count[i];
+                _presieve_factor[i] *= p;
+            }
         }
-        p.n = 2*i+1 + offset;
     }
 
-    inline void count_primepower(size_t offset, primepower_t& p)
+    // initialize count & factor for segment at offset with the presieve pattern
+    template<bool Odd>
+    inline void presieve(size_t offset)
     {
-        if (p.n < offset || p.n >= offset+segment_size)
-            throw std::runtime_error("count_prime: out of range");
-        size_t i = (p.n - offset)/2;
-        for (; i < segment_size/2; i += p.q)
+        const size_t stride = Odd ? 2 : 1;
+        const size_t period = _presieve_count.size();
+        size_t phase = (offset/stride) % period;
+        for (size_t i = 0; i < segment_size/stride; )
         {
-            ++count[i];
-            factor[i] *= p.p;
+            size_t len = std::min<size_t>(segment_size/stride - i, period - phase);
+            std::copy(_presieve_count.begin() + phase, _presieve_count.begin() + phase + len, count.begin() + i);
+            std::copy(_presieve_factor.begin() + phase, _presieve_factor.begin() + phase + len, factor.begin() + i);
+            i += len;
+            phase = 0;
         }
-        p.n = 2*i+1 + offset;
     }
 
-public:    
-    void count_almostprimes(bool countodd =  true, bool countall = true)
+    // print counts for [2^k, 2^(k+1)) from interval_counts_odd[k] and interval_counts[k-1]
+    void print_interval(size_t k, bool countodd, bool countall)
+    {
+        interval_counts[k] = interval_counts_odd[k];
+        for (size_t i = 1; i <= k; ++i)
+            interval_counts[k][i] += interval_counts[k-1][i-1];
+        if (_format == format_json)
+        {
+            // one JSON object per line: {"k":k,"odd":[c(k,1),...,c(k,k)],"all":[...]}
+            std::cout << "{\"k\":" << k;
+            if (countodd)
+            {
+                std::cout << ",\"odd\":[";
+                for (size_t c = 1; c <= k; ++c)
+                    std::cout << (c == 1 ? "" : ",") << interval_counts_odd[k][ c ];
+                std::cout << "]";
+            }
+            if (countall)
+            {
+                std::cout << ",\"all\":[";
+                for (size_t c = 1; c <= k; ++c)
+                    std::cout << (c == 1 ? "" : ",") << interval_counts[k][ c ];
+                std::cout << "]";
+            }
+            std::cout << "}" << std::endl;
+            return;
+        }
+        if (_format == format_csv)
+        {
+            // one row per count: k,type,i,c(k,i)
+            if (k == 1)
+                std::cout << "k,type,i,count" << std::endl;
+            for (size_t c = 1; countodd && c <= k; ++c)
+                std::cout << k << ",odd," << c << "," << interval_counts_odd[k][ c ] << "\n";
+            for (size_t c = 1; countall && c <= k; ++c)
+                std::cout << k << ",all," << c << "," << interval_counts[k][ c ] << "\n";
+            std::cout << std::flush;
+            return;
+        }
+        if (k == 1)
+        {
+            std::cout << "Output format: 'k: c(k,1) c(k,2) ....', where c(k,i) = #{ (odd) i-almostprimes in [2^k, 2^(k+1)) }." << std::endl;
+        }
+        integer_t maxnum = 0;
+        for (auto v : interval_counts[k])
+            if (v > maxnum)
+                maxnum = v;
+        size_t printwidth = std::to_string(maxnum).size();
+        if (countodd)
+        {
+            std::cout << std::setw(2) << k << ":";
+            for (size_t c = 1; c <= k; ++c)
+                std::cout << " " << std::setw(printwidth) << interval_counts_odd[k][ c ];
+            std::cout << " (odd) " << std::endl;
+        }
+        if (countall)
+        {
+            std::cout << std::setw(2) << k << ":";
+            for (size_t c = 1; c <= k; ++c)
+                std::cout << " " << std::setw(printwidth) << interval_counts[k][ c ];
+            std::cout << " (all) " << std::endl;
+        }
+    }
+
+    // print progress report to stderr
+    void print_progress(size_t done, size_t total, double seconds)
+    {
+        double rate = done / seconds;
+        double eta = (total - done) / rate;
+        if (_format == format_text)
+        {
+            unsigned long long etas = (unsigned long long)(eta);
+            std::cerr << "Progress: " << done << "/" << total << " segments (" << std::fixed << std::setprecision(2) << 100.0*done/total << "%), "
+                << std::setprecision(1) << rate << " segments/s, ETA " << etas/3600 << "h" << std::setfill('0') << std::setw(2) << (etas/60)%60 << "m" << std::setw(2) << etas%60 << "s"
+                << std::setfill(' ') << std::defaultfloat << std::endl;
+        } else if (_format == format_json)
+        {
+            std::cerr << "{\"progress\":{\"segments\":" << done << ",\"total\":" << total << ",\"elapsed\":" << seconds << ",\"rate\":" << rate << ",\"eta\":" << eta << "}}" << std::endl;
+        } else
+        {
+            std::cerr << "progress," << done << "," << total << "," << seconds << "," << rate << "," << eta << std::endl;
+        }
+    }
+
+    void reset_counts()
     {
         interval_counts.clear();
         interval_counts.resize(_maxbits+1, std::vector<size_t>(_maxbits+1, 0));
         interval_counts_odd.clear();
         interval_counts_odd.resize(_maxbits+1, std::vector<size_t>(_maxbits+1, 0));
+        interval_counts[0][0] = 1;
+    }
 
-        count.resize(segment_size/2);
-        factor.resize(segment_size/2);
+    // sieve (odd) integers in segments [segbegin, segend), i.e. integers [segbegin*segment_size, segend*segment_size)
+    // calls consume(offset) for each segment once count & factor hold the number of prime factors & their product
+    // and with Factors the factor lists hold the walked prime factors
+    template<bool Odd, bool Factors = false, typename F>
+    void sieve_segments(size_t segbegin, size_t segend, F&& consume)
+    {
+        const size_t stride = Odd ? 2 : 1;
+        count.resize(segment_size/stride);
+        factor.resize(segment_size/stride);
+        if (Factors)
+            factorhead.resize(segment_size/stride);
+        make_presieve(Odd);
+
+        // walk the primes p < sqrt(2^maxbits) except the presieve primes
+        const std::vector<integer_t> skip(std::begin(_presieveprimes), std::end(_presieveprimes));
+        prime_walker<Odd> walker;
+        walker.reset(_sqrtmaxval, segbegin, segend * segment_size, skip);
+        const hit_t<Factors> hit(*this);
 
         // start of first segment
-        size_t offset = 0;
-
-        // small prime (powers) < segmentsize
-        std::vector<prime_t> smallprimes;
-        std::vector<primepower_t> smallprimepowers;
-        // prime (powers): [segmentsize, sqrtmaxbits)
-        std::deque< std::vector< prime_t > > segmentprimes( (_sqrtmaxval / segment_size)*2+4 );
-        std::deque< std::vector< primepower_t > > segmentprimepowers( (_sqrtmaxval / segment_size)*2+4 );
-        // prime powers > sqrtmaxbits
-        std::map< integer_t, std::list<primepower_t> > largeprimepowers;
-
-        // distribute primes
-        for (auto p : _primecache)
+        size_t offset = segbegin * segment_size;
+        status() << "Sieving with primes p < " << _sqrtmaxval << "..." << std::endl;
+
+        // progress reports
+        typedef std::chrono::steady_clock clock_t;
+        const clock_t::time_point starttime = clock_t::now();
+        clock_t::time_point nextreport = starttime + std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(_progressinterval));
+
+        for (; offset < segend * segment_size; offset += segment_size)
         {
-            if (p == 2)
-                continue;
-            if (2*p < segment_size)
-                smallprimes.emplace_back(p,p);
-            else
-                segmentprimes[p / segment_size].emplace_back(p,p);
-            for (size_t q = p*p, oq = p; q < _maxval; q *= p)
+            if (_progressinterval > 0 && (offset / segment_size) % 256 == 0 && clock_t::now() >= nextreport)
             {
-                if (q < oq) // overflow: real q > _maxval
-                    break;
-                oq = q;
-
-                if (2*q < segment_size)
-                {
-                    smallprimepowers.emplace_back(p,q,q);
-                } else {
-                    if (q < _sqrtmaxval)
-                        segmentprimepowers[q / segment_size].emplace_back(p,q,q);
-                    else
-                        largeprimepowers[q].emplace_back(p,q,q);
-                }
+                nextreport += std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(_progressinterval));
+                print_progress(offset / segment_size - segbegin, segend - segbegin, std::chrono::duration<double>(clock_t::now() - starttime).count());
             }
-        }
 
-        interval_counts[0][0] = 1;
-        size_t k = 1, lb = 1ULL<<k, ub = 2ULL<<k;
-        for (; offset < (1ULL<<_maxbits); offset += segment_size)
-        {
-            // reset count & factor
-            std::fill(count.begin(), count.end(), 0);
-            std::fill(factor.begin(), factor.end(), 1);
-
-            // process small prime (powers) < segmentsize
-            for (auto& p : smallprimes)
-                count_prime(offset, p);
-            for (auto& q : smallprimepowers)
-                count_primepower(offset, q);
-
-            // process large prime (powers) > segmentsize
-            if (!segmentprimes.empty())
+            // reset count & factor to the presieve pattern
+            presieve<Odd>(offset);
+            if (Factors)
             {
-                for (auto p : segmentprimes.front())
-                {
-                    count_prime(offset, p);
-                    size_t i = (p.n - offset) / segment_size;
-                    if (i == 0 || i >= segmentprimes.size())
-                        throw std::runtime_error("segmentprimes insertion error");
-                    segmentprimes[i].emplace_back(p);
-                }
-                segmentprimes.emplace_back( std::move( segmentprimes.front() ) );
-                segmentprimes.pop_front();
-                segmentprimes.back().clear();
+                std::fill(factorhead.begin(), factorhead.end(), 0);
+                factornext.clear();
+                factorprime.clear();
             }
-            if (!segmentprimepowers.empty())
+
+            walker.walk(hit);
+
+            // integers that differ from their current factor product lack exactly one large prime >= _sqrtmaxval
+            for (size_t i = 0, n = offset + (Odd ? 1 : 0); i < segment_size/stride; ++i, n += stride)
             {
-                for (auto q : segmentprimepowers.front())
-                {
-                    count_primepower(offset, q);
-                    size_t i = (q.n - offset) / segment_size;
-                    if (i == 0 || i >= segmentprimepowers.size())
-                        throw std::runtime_error("segmentprimepowers insertion error");
-                    segmentprimepowers[i].emplace_back(q);
-                }
-                segmentprimepowers.emplace_back( std::move( segmentprimepowers.front() ) );
-                segmentprimepowers.pop_front();
-                segmentprimepowers.back().clear();
+                if (hit.factor[i] != n)
+                    ++hit.count[i];
             }
-            
-            // process very large prime powers >= _sqrtmaxval (of primes < _sqrtmaxval)
-            auto it = largeprimepowers.begin();
-            while (it != largeprimepowers.end() && it->first < offset+segment_size)
+
+            consume(offset);
+        }
+    }
+
+    // count odd almostprimes in segments [segbegin, segend), i.e. integers [segbegin*segment_size, segend*segment_size)
+    // adds to interval_counts_odd and calls finished(k) when all segments of [2^k, 2^(k+1)) have been processed
+    template<typename F>
+    void count_segments(size_t segbegin, size_t segend, F&& finished)
+    {
+        sieve_segments<true>(segbegin, segend, [&](size_t offset)
+        {
+            if (offset == 0)
             {
-                while (!it->second.empty())
+                // first segment contains the intervals [2^k, 2^(k+1)) for 1 <= k < log2(segment_size)
+                for (size_t k = 1; (2ULL<<k) <= segment_size; ++k)
                 {
-                    auto& q = it->second.front();
-                    count_primepower(offset, q);
-                    largeprimepowers[q.n].splice( largeprimepowers[q.n].begin(), it->second, it->second.begin() );
+                    for (size_t i = (1ULL<<k)/2; i < (2ULL<<k)/2; ++i)
+                        ++interval_counts_odd[k][ count[i] ];
+                    finished(k);
                 }
-                it = largeprimepowers.erase(it);
+            } else {
+                // any other segment is fully contained in one interval [2^k, 2^(k+1))
+                size_t k = 63 - __builtin_clzll(offset);
+                for (size_t i = 0; i < segment_size/2; ++i)
+                    ++interval_counts_odd[k][ count[i] ];
+                if (offset + segment_size == (2ULL<<k))
+                    finished(k);
             }
+        });
+    }
 
-            // integers that differ from their current factor product lack exactly one large prime >= _sqrtmaxval
-            for (size_t i = 0, n = offset + 1; i < segment_size/2; ++i, n += 2)
+    // enumerate (odd) n in [lb, ub) with k = Omega(n) in the set kmask: bit k set <=> select Omega(n) == k
+    // calls f(n, k, P, i) in increasing order of n where P is the prime factor of n >= sqrt(2^maxbits), or 1 if there is none,
+    // and i the index of n in the current segment, see segment_factors
+    template<bool Odd, bool Factors, typename F>
+    void enumerate_segments(integer_t lb, integer_t ub, std::uint64_t kmask, F&& f)
+    {
+        const size_t stride = Odd ? 2 : 1;
+        if (lb < 1)
+            lb = 1;
+        if (lb >= ub)
+            return;
+        sieve_segments<Odd, Factors>(lb / segment_size, (ub + segment_size - 1) / segment_size, [&](size_t offset)
+        {
+            integer_t n = offset + (Odd ? 1 : 0);
+            for (size_t i = 0; i < segment_size/stride; ++i, n += stride)
             {
-                if (factor[i] != n)
-                    ++count[i];
+                if (count[i] >= 64 || ((kmask >> count[i]) & 1) == 0 || n < lb || n >= ub)
+                    continue;
+                f(n, size_t(count[i]), factor[i] == n ? integer_t(1) : n / factor[i], i);
             }
+        });
+    }
 
-            // do all counts
-            while (true)
-            {
-                if (lb < offset) throw;
-                size_t segment_ub = std::min<size_t>(ub, offset+segment_size);
+    // set factors to the prime factors of n with index i in the current segment with multiplicity in increasing order,
+    // given its prime factor P >= sqrt(2^maxbits) or 1: the walked primes are in the factor lists, the presieve primes are not
+    void segment_factors(size_t i, integer_t n, integer_t P, std::vector<integer_t>& factors) const
+    {
+        factors.clear();
+        for (std::uint32_t j = factorhead[i]; j != 0; j = factornext[j-1])
+            factors.emplace_back(factorprime[j-1]);
+        for (auto p : _presieveprimes)
+            if (n % p == 0)
+                factors.emplace_back(p);
+        if (P > 1)
+            factors.emplace_back(P);
+        std::sort(factors.begin(), factors.end());
+    }
 
-                for (integer_t i = (lb-offset)/2; i < (segment_ub-offset)/2; ++i)
-                    ++interval_counts_odd[k][ count[i] ];
+public:    
+    void count_almostprimes(bool countodd =  true, bool countall = true)
+    {
+        reset_counts();
+        count_segments(0, _maxval / segment_size, [&](size_t k){ print_interval(k, countodd, countall); });
+    }
 
-                if (segment_ub == ub)
+    // count almostprimes only for shard i of N, each shard processes a consecutive block of segments
+    // the partial counts are printed as 'partial maxbits=... shard=i/N k=...: c(k,0) c(k,1) ...'
+    void count_almostprimes_shard(size_t shard, size_t shards)
+    {
+        reset_counts();
+        size_t segments = _maxval / segment_size;
+        size_t segbegin = (segments/shards)*shard + std::min(shard, segments%shards);
+        size_t segend = segbegin + segments/shards + (shard < segments%shards ? 1 : 0);
+        count_segments(segbegin, segend, [](size_t){});
+        for (size_t k = 1; k < _maxbits; ++k)
+        {
+            std::cout << "partial maxbits=" << _maxbits << " shard=" << shard << "/" << shards << " k=" << k << ":";
+            for (size_t c = 0; c <= k; ++c)
+                std::cout << " " << interval_counts_odd[k][c];
+            std::cout << std::endl;
+        }
+    }
+
+    // enumerate all n in [lb, ub) with Omega(n) in kmask, or only odd n if oddonly, and call f(n, k, P), see enumerate_segments
+    template<typename F>
+    void enumerate_almostprimes(integer_t lb, integer_t ub, std::uint64_t kmask, bool oddonly, F&& f)
+    {
+        if (ub > _maxval)
+            throw std::runtime_error("enumerate_almostprimes: upper bound exceeds 2^maxbits");
+        auto g = [&](integer_t n, size_t k, integer_t P, size_t) { f(n, k, P); };
+        if (oddonly)
+            enumerate_segments<true, false>(lb, ub, kmask, g);
+        else
+            enumerate_segments<false, false>(lb, ub, kmask, g);
+    }
+
+    // as enumerate_almostprimes, but call f(n, factors) with the prime factors of n with multiplicity in increasing order
+    // the factors are recorded while the segment is sieved
+    template<typename F>
+    void factorize_almostprimes(integer_t lb, integer_t ub, std::uint64_t kmask, bool oddonly, F&& f)
+    {
+        if (ub > _maxval)
+            throw std::runtime_error("factorize_almostprimes: upper bound exceeds 2^maxbits");
+        std::vector<integer_t> factors;
+        auto g = [&](integer_t n, size_t, integer_t P, size_t i)
+            {
+                segment_factors(i, n, P, factors);
+                f(n, static_cast<const std::vector<integer_t>&>(factors));
+            };
+        if (oddonly)
+            enumerate_segments<true, true>(lb, ub, kmask, g);
+        else
+            enumerate_segments<false, true>(lb, ub, kmask, g);
+    }
+
+    // combine the partial counts of shards 0..N-1 and print counts as count_almostprimes
+    void merge_shards(const std::vector<std::string>& files, bool countodd = true, bool countall = true)
+    {
+        reset_counts();
+        size_t shards = 0;
+        std::set<size_t> seen;
+        for (auto& file : files)
+        {
+            std::ifstream ifs(file.c_str());
+            if (!ifs)
+                throw std::runtime_error("Could not open file: " + file);
+            std::string line;
+            while (std::getline(ifs, line))
+            {
+                unsigned long long maxbits, i, n, k;
+                int len = 0;
+                if (sscanf(line.c_str(), "partial maxbits=%llu shard=%llu/%llu k=%llu:%n", &maxbits, &i, &n, &k, &len) != 4)
+                    continue;
+                if (maxbits != _maxbits || i >= n || (shards != 0 && n != shards) || k == 0 || k >= _maxbits)
+                    throw std::runtime_error("Inconsistent shard: " + line);
+                shards = n;
+                if (k == 1 && !seen.insert(i).second)
+                    throw std::runtime_error("Duplicate shard: " + line);
+                std::stringstream strstr(line.substr(len));
+                for (size_t c = 0; c <= k; ++c)
                 {
-                    if (k == 1)
-                    {
-                        std::cout << "Output format: 'k: c(k,1) c(k,2) ....', where c(k,i) = #{ (odd) i-almostprimes in [2^k, 2^(k+1)) }." << std::endl;
-                    }
-                    interval_counts[k] = interval_counts_odd[k];
-                    for (size_t i = 1; i <= k; ++i)
-                        interval_counts[k][i] += interval_counts[k-1][i-1];
-                    integer_t maxnum = 0;
-                    for (auto v : interval_counts[k])
-                        if (v > maxnum)
-                            maxnum = v;
-                    size_t printwidth = std::to_string(maxnum).size();
-                    if (countodd)
-                    {
-                        std::cout << std::setw(2) << k << ":";
-                        for (size_t c = 1; c <= k; ++c)
-                            std::cout << " " << std::setw(printwidth) << interval_counts_odd[k][ c ];
-                        std::cout << " (odd) " << std::endl;
-                    }
-                    if (countall)
-                    {
-                        std::cout << std::setw(2) << k << ":";
-                        for (size_t c = 1; c <= k; ++c)
-                            std::cout << " " << std::setw(printwidth) << interval_counts[k][ c ];
-                        std::cout << " (all) " << std::endl;
-                    }
-                    // finished counting for [2^k, 2^(k+1) ), increase k
-                    ++k;
-                    lb = 1ULL<<k;
-                    ub = 2ULL<<k;
-                } else {
-                    // this k is still unfinished
-                    lb = segment_ub;
-                    break;
+                    size_t v;
+                    if (!(strstr >> v))
+                        throw std::runtime_error("Could not parse shard: " + line);
+                    interval_counts_odd[k][c] += v;
                 }
             }
         }
+        if (shards == 0 || seen.size() != shards)
+            throw std::runtime_error("Missing shards: found " + std::to_string(seen.size()) + " of " + std::to_string(shards));
+        for (size_t k = 1; k < _maxbits; ++k)
+            print_interval(k, countodd, countall);
     }
 };
 
@@ -308,20 +496,79 @@ int main(int argc, char** argv)
 {
     // command line interface
     size_t k = 1;
+    std::string shardstr, format = "text", hugepages = "none", liststr;
+    std::uint64_t lb = 0, ub = 0;
+    double progress = 0;
     po::options_description opts("Command line options");
     opts.add_options()
         ("help,h", "Show options")
         ("k", po::value<size_t>(&k), "Output almost prime counts [2^i, 2^(i+1)) for i in [1,k). Must be 16 <= k < 64.")
         ("odd,o", "Print counts for odd almostprimes")
         ("all,a", "Print counts for all almostprimes")
+        ("format,f", po::value<std::string>(&format)->default_value("text"), "Output format: text, json (one object per line) or csv")
+        ("progress,p", po::value<double>(&progress)->default_value(0), "Print progress report to stderr every given number of seconds (0 = disabled)")
+        ("shard", po::value<std::string>(&shardstr), "Only process shard i/N of the segments and print partial counts.\nCombine the outputs of all shards using: almostprimecount merge <k> <files>")
+        ("hugepages", po::value<std::string>(&hugepages)->default_value("none"), "Huge pages for sieve buffers: none, 2m or 1g (Linux only)")
+        ("list,l", po::value<std::string>(&liststr), "Instead of counting, print all n in [begin,end) with Omega(n) in the given comma separated set, e.g. 2 or 2,3")
+        ("begin,b", po::value<std::uint64_t>(&lb)->default_value(0), "Lower bound for --list")
+        ("end,e", po::value<std::uint64_t>(&ub), "Upper bound for --list (at most 2^63)")
+        ("factors", "With --list print 'n: p1 p2 ...' with the prime factors of n")
         ;
     po::variables_map vm;
     bool allow_unregistered = false, allow_positional = true;
     po::store(po::parse_command_line(argc, argv, opts, allow_unregistered, allow_positional), vm);
+    pg::memory_policy().pages = pg::parse_page_policy(hugepages);
+    // merge subcommand: almostprimecount merge <k> <files>
+    bool merge = vm.positional.size() >= 1 && vm.positional[0].as<std::string>() == "merge";
     // if at least 1 positional argument is given then parse as: <k>
-    if (vm.positional.size() >= 1)
+    if (vm.positional.size() >= (merge ? 2 : 1))
     {
-        k = vm.positional[0].as<size_t>();
+        k = vm.positional[merge ? 1 : 0].as<size_t>();
+    }
+    size_t shard = 0, shards = 1;
+    if (vm.count("shard"))
+    {
+        char c = 0;
+        std::stringstream strstr(shardstr);
+        strstr >> shard >> c >> shards;
+        if (!strstr || c != '/' || shard >= shards)
+            throw std::runtime_error("Invalid shard (expected i/N with 0 <= i < N): " + shardstr);
+    }
+
+    // list almostprimes: the sieve covers [0, 2^k) with the smallest k >= 16 such that end <= 2^k
+    if (vm.count("list") && !vm.count("help"))
+    {
+        if (!vm.count("end") || ub > (1ULL<<63))
+            throw std::runtime_error("--list requires --end <= 2^63");
+        std::uint64_t kmask = 0;
+        std::stringstream strstr(liststr);
+        for (std::string kstr; std::getline(strstr, kstr, ','); )
+        {
+            size_t c = std::stoul(kstr);
+            if (c >= 64)
+                throw std::runtime_error("Invalid --list: " + liststr);
+            kmask |= 1ULL << c;
+        }
+        for (k = 16; (1ULL<<k) < ub; ++k)
+            ;
+        // status messages go to stderr, keeping the list on stdout clean
+        pg::almost_prime_sieve sieve(k, pg::almost_prime_sieve::format_text, 0, &std::cerr);
+        bool oddonly = vm.count("odd") && !vm.count("all");
+        if (vm.count("factors"))
+        {
+            sieve.factorize_almostprimes(lb, ub, kmask, oddonly, [&](std::uint64_t n, const std::vector<std::uint64_t>& factors)
+                {
+                    std::cout << n << ":";
+                    for (auto p : factors)
+                        std::cout << " " << p;
+                    std::cout << "\n";
+                });
+        } else {
+            pg::printprime print;
+            sieve.enumerate_almostprimes(lb, ub, kmask, oddonly, [&](std::uint64_t n, size_t, std::uint64_t) { print(n); });
+        }
+        std::cout << std::flush;
+        return 0;
     }
 
     // print help
@@ -333,10 +580,28 @@ int main(int argc, char** argv)
     bool printodd = vm.count("odd") || vm.count("all")==0;
     bool printall = vm.count("all") || vm.count("odd")==0;
 
+    pg::almost_prime_sieve::output_format_t outputformat = pg::almost_prime_sieve::format_text;
+    if (format == "json")
+        outputformat = pg::almost_prime_sieve::format_json;
+    else if (format == "csv")
+        outputformat = pg::almost_prime_sieve::format_csv;
+    else if (format != "text")
+        throw std::runtime_error("Unknown output format: " + format);
+
     // execute
-    pg::almost_prime_sieve sieve( k);
-    sieve.prepare_primecache();
-    sieve.count_almostprimes(printodd, printall );
+    pg::almost_prime_sieve sieve( k, outputformat, progress);
+    if (merge)
+    {
+        std::vector<std::string> files;
+        for (size_t i = 2; i < vm.positional.size(); ++i)
+            files.emplace_back(vm.positional[i].as<std::string>());
+        sieve.merge_shards(files, printodd, printall);
+        return 0;
+    }
+    if (vm.count("shard"))
+        sieve.count_almostprimes_shard(shard, shards);
+    else
+        sieve.count_almostprimes(printodd, printall );
 
     return 0;
 }
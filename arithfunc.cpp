@@ -0,0 +1,152 @@
+/*********************************************************************************\
+*                                                                                 *
+* https://github.com/cr-marcstevens/primegen                                      *
+*                                                                                 *
+* MIT License                                                                     *
+*                                                                                 *
+* Copyright (c) 2021 Marc Stevens                                                 *
+*                                                                                 *
+* Permission is hereby granted, free of charge, to any person obtaining a copy    *
+* of this software and associated documentation files (the "Software"), to deal   *
+* in the Software without restriction, including without limitation the rights    *
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell       *
+* copies of the Software, and to permit persons to whom the Software is           *
+* furnished to do so, subject to the following conditions:                        *
+*                                                                                 *
+* The above copyright notice and this permission notice shall be included in all  *
+* copies or substantial portions of the Software.                                 *
+*                                                                                 *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR      *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,        *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE     *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER          *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,   *
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE   *
+* SOFTWARE.                                                                       *
+*                                                                                 *
+\*********************************************************************************/
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "multiplicative_sieve.hpp"
+#include "program_options.hpp"
+
+namespace pg = primegen;
+namespace po = program_options;
+
+int main(int argc, char** argv)
+{
+    // command line interface
+    size_t lb = 1, ub = 0;
+    unsigned threads = 1;
+    std::string binaryfile, queryfile, hugepages = "none";
+    po::options_description opts("Command line options");
+    opts.add_options()
+        ("help,h", "Show options")
+        ("begin,b", po::value<size_t>(&lb)->default_value(1), "Begin of range")
+        ("end,e", po::value<size_t>(&ub), "End of range (exclusive)")
+        ("mertens,m", "Print Mertens function M(end-1)")
+        ("liouville,l", "Print summatory Liouville function L(end-1)")
+        ("omega,o", "Print distribution of omega and Omega over [begin,end)")
+        ("list", "Print 'n omega Omega mu lambda phi spf lpf' for each n in [begin,end)")
+        ("factor,f", "Print 'n: p1 p2 ...' with all prime factors for each n in [begin,end)")
+        ("binary", po::value<std::string>(&binaryfile), "With --factor: write factorizations in compact binary format to file")
+        ("queries,q", po::value<std::string>(&queryfile), "Print 'n: p1 p2 ...' for each distinct integer 0 < n < end in file, in increasing order of n")
+        ("threads,t", po::value<unsigned>(&threads)->default_value(1), "Number of threads")
+        ("hugepages", po::value<std::string>(&hugepages)->default_value("none"), "Huge pages for sieve buffers: none, 2m or 1g (Linux only)")
+        ("numa", "Best effort: pin threads round-robin to the CPUs of NUMA nodes, so their buffers are first touched on the local node (Linux only, no-op otherwise)")
+        ;
+    po::variables_map vm;
+    bool allow_unregistered = false, allow_positional = true;
+    po::store(po::parse_command_line(argc, argv, opts, allow_unregistered, allow_positional), vm);
+    pg::memory_policy().pages = pg::parse_page_policy(hugepages);
+    pg::memory_policy().numa_bind = vm.count("numa") != 0;
+    // if two positional arguments are given then parse as: <lb> <ub>
+    if (vm.positional.size() >= 2)
+    {
+        ub = vm.positional[1].as<size_t>();
+        lb = vm.positional[0].as<size_t>();
+    }
+    // if only one positional argument is given then parse as: <ub>
+    else if (vm.positional.size() == 1)
+    {
+        ub = vm.positional[0].as<size_t>();
+    }
+
+    // print help
+    if (vm.count("help") || ub <= lb || (!vm.count("mertens") && !vm.count("liouville") && !vm.count("omega") && !vm.count("list") && !vm.count("factor") && !vm.count("queries")))
+    {
+        po::print_options_description({opts});
+        return 0;
+    }
+
+    // execute
+    pg::multiplicative_sieve ms(ub);
+    if (vm.count("mertens"))
+        std::cout << "M(" << ub-1 << ")=" << ms.mertens(ub-1, threads) << std::endl;
+    if (vm.count("liouville"))
+        std::cout << "L(" << ub-1 << ")=" << ms.liouville(ub-1, threads) << std::endl;
+    if (vm.count("omega"))
+    {
+        auto counts = ms.omega_distribution(lb, ub, threads);
+        for (size_t k = 0; k < counts[0].size(); ++k)
+            if (counts[0][k] != 0 || counts[1][k] != 0)
+                std::cout << "k=" << k << " omega=" << counts[0][k] << " Omega=" << counts[1][k] << std::endl;
+    }
+    if (vm.count("list"))
+    {
+        ms.sieve(lb, ub, [](const pg::multiplicative_sieve::segment_t& s)
+            {
+                for (size_t i = s.begin; i < s.end; ++i)
+                    std::cout << s.n(i) << " " << unsigned(s.omega[i]) << " " << unsigned(s.Omega[i]) << " " << s.mu(i) << " " << s.lambda(i)
+                        << " " << s.phi[i] << " " << s.spf[i] << " " << s.lpf[i] << "\n";
+            });
+    }
+    if (vm.count("factor") || vm.count("queries"))
+    {
+        auto printfactors = [](uint64_t n, const std::vector<uint64_t>& f)
+            {
+                std::cout << n << ":";
+                for (auto p : f)
+                    std::cout << " " << p;
+                std::cout << "\n";
+            };
+        if (vm.count("queries"))
+        {
+            std::ifstream ifs(queryfile.c_str());
+            if (!ifs)
+                throw std::runtime_error("Could not open file: " + queryfile);
+            std::vector<uint64_t> queries;
+            uint64_t n;
+            while (ifs >> n)
+            {
+                if (n == 0 || n >= ub)
+                    throw std::runtime_error("Query out of range (expected 0 < n < end): " + std::to_string(n));
+                queries.emplace_back(n);
+            }
+            if (!ifs.eof())
+                throw std::runtime_error("Could not parse query in file: " + queryfile);
+            ms.factorize_batch(queries, printfactors);
+        }
+        else if (vm.count("binary"))
+        {
+            FILE* fd = fopen(binaryfile.c_str(), "wb");
+            if (fd == nullptr)
+                throw std::runtime_error("Could not open file: " + binaryfile);
+            {
+                pg::factor_writer writer(fd);
+                ms.factorize(lb, ub, writer);
+                writer.flush();
+            }
+            if (fclose(fd) != 0)
+                throw std::runtime_error("Could not write file: " + binaryfile);
+        }
+        else
+            ms.factorize(lb, ub, printfactors);
+    }
+
+    return 0;
+}
@@ -0,0 +1,667 @@
+/*********************************************************************************\
+*                                                                                 *
+* https://github.com/cr-marcstevens/primegen                                      *
+*                                                                                 *
+* MIT License                                                                     *
+*                                                                                 *
+* Copyright (c) 2021 Marc Stevens                                                 *
+*                                                                                 *
+* Permission is hereby granted, free of charge, to any person obtaining a copy    *
+* of this software and associated documentation files (the "Software"), to deal   *
+* in the Software without restriction, including without limitation the rights    *
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell       *
+* copies of the Software, and to permit persons to whom the Software is           *
+* furnished to do so, subject to the following conditions:                        *
+*                                                                                 *
+* The above copyright notice and this permission notice shall be included in all  *
+* copies or substantial portions of the Software.                                 *
+*                                                                                 *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR      *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,        *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE     *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER          *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,   *
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE   *
+* SOFTWARE.                                                                       *
+*                                                                                 *
+\*********************************************************************************/
+
+#ifndef MULTIPLICATIVE_SIEVE_HPP
+#define MULTIPLICATIVE_SIEVE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <list>
+#include <thread>
+
+#include "primegen.hpp"
+
+namespace primegen
+{
+
+// Walks the primes p < pmax and their powers over consecutive segments of segment_size integers,
+// the segmented engine shared by multiplicative_sieve and almost_prime_sieve:
+// - Odd: a segment holds only its odd integers with index i for n = offset + 2i + 1, otherwise index i is n = offset + i
+//   consecutive (odd) multiples of m are m indices apart in both layouts
+// - the base primes are generated in increasing order in chunks and activated once the walk reaches them,
+//   a prime p first hits n >= p so the walk starts immediately
+// - small prime (powers) below segment_indices hit every segment and are kept with their next multiple
+// - prime (powers) in [segment_indices, pmax) hit a segment at most once and are kept in rings of buckets
+//   with the 32-bit prime, or the index of the prime power in _powers, and the index of the next hit
+// - prime powers >= max(pmax, segment_indices) are kept in a map by their next multiple: they are only inserted once the walk reaches their
+//   first multiple, by a cursor per exponent e over the primes p with p^e ahead of the walk, and dropped after their last multiple < ub
+template<bool Odd>
+class prime_walker
+{
+public:
+    typedef std::uint64_t integer_t;
+    typedef std::size_t size_t;
+
+    static const size_t segment_size = 1ULL<<16;
+    static const size_t stride = Odd ? 2 : 1;
+    static const size_t segment_indices = segment_size / stride;
+
+    // first (odd) multiple of m that is >= max(m, x)
+    static inline integer_t first_multiple(integer_t m, integer_t x)
+    {
+        if (x <= m)
+            return m;
+        integer_t n = ((x + m - 1) / m) * m;
+        if (Odd && n % 2 == 0)
+            n += m;
+        return n;
+    }
+
+    // start a walk of the primes p < pmax <= 2^32 over the segments [seg*segment_size, (seg+1)*segment_size)
+    // for seg = segbegin, segbegin+1, ... that start below ub, the primes in skip are not walked but their powers are
+    void reset(integer_t pmax, integer_t segbegin, integer_t ub, const std::vector<integer_t>& skip = std::vector<integer_t>())
+    {
+        _pmax = pmax;
+        _begin = _offset = segbegin * segment_size;
+        _ub = ub;
+        _skip = skip;
+        _basegen.reserve(_pmax);
+        _basenext = 0;
+        _smallprimes.clear();
+        _smallpowers.clear();
+        _primering.reset(_pmax, segment_indices);
+        _powerring.reset(_pmax, segment_indices);
+        _powers.clear();
+        _largepowers.clear();
+        // powers p^e >= max(pmax, segment_indices, begin) are inserted by the cursors
+        const integer_t t0 = std::max(_largelb(), _begin);
+        for (unsigned e = 0; e < 64; ++e)
+        {
+            _powerroot[e] = e < 2 ? _pmax : std::min(_iroot_ceil(t0, e), _pmax);
+            _powernext[e] = _powerroot[e] >= _pmax ? ~integer_t(0) : _pow(_powerroot[e], e);
+        }
+        _powermin = *std::min_element(_powernext, _powernext + 64);
+    }
+
+    // offset of the next segment
+    integer_t offset() const { return _offset; }
+
+    // walk the next segment: call hit.prime(i, p) for every walked prime p and hit.power(i, p) for every walked power p^k, k > 1,
+    // that divides the integer with index i, hits beyond ub in the last segment may be reported
+    template<typename H>
+    void walk(H hit)
+    {
+        const integer_t offset = _offset;
+        const integer_t seg = offset / segment_size;
+        _offset += segment_size;
+
+        // base primes and large prime powers that first hit this segment
+        _activate(offset, offset + segment_size);
+        if (_powermin < offset + segment_size)
+            _insert_powers(std::min<integer_t>(_ub, offset + powerhorizon));
+
+        // small prime (powers) < segment_indices
+        for (auto& sp : _smallprimes)
+        {
+            const integer_t p = sp.p;
+            size_t i = (sp.n - offset)/stride;
+            for (; i < segment_indices; i += p)
+                hit.prime(i, p);
+            sp.n = offset + stride*i + (Odd ? 1 : 0);
+        }
+        for (auto& sq : _smallpowers)
+        {
+            const integer_t p = sq.p, q = sq.q;
+            size_t i = (sq.n - offset)/stride;
+            for (; i < segment_indices; i += q)
+                hit.power(i, p);
+            sq.n = offset + stride*i + (Odd ? 1 : 0);
+        }
+
+        // prime (powers) in [segment_indices, pmax) in the bucket of this segment
+        // move to the bucket of the segment of their next multiple
+        typedef typename basic_bucket_ring<uint32_t>::entry_t entry_t;
+        _primering.process(seg, [hit](const entry_t& bp)
+            {
+                hit.prime(bp.index, bp.p);
+                return uint64_t(bp.index) + bp.p;
+            });
+        _powerring.process(seg, [this, hit](const entry_t& bq)
+            {
+                const auto& pq = _powers[bq.p];
+                hit.power(bq.index, pq.first);
+                return uint64_t(bq.index) + pq.second;
+            });
+
+        // prime powers >= pmax with a multiple in this segment, indices >= iend are >= ub
+        const integer_t iend = (_ub - offset - (Odd ? 1 : 0) + stride - 1) / stride;
+        auto it = _largepowers.begin();
+        while (it != _largepowers.end() && it->first < offset + segment_size)
+        {
+            while (!it->second.empty())
+            {
+                auto& q = it->second.front();
+                integer_t i = (q.n - offset)/stride;
+                while (true)
+                {
+                    hit.power(size_t(i), q.p);
+                    if (q.q >= iend - i)
+                    {
+                        i = iend;
+                        break;
+                    }
+                    i += q.q;
+                    if (i >= segment_indices)
+                        break;
+                }
+                if (i < iend)
+                {
+                    q.n = offset + stride*i + (Odd ? 1 : 0);
+                    _largepowers[q.n].splice( _largepowers[q.n].begin(), it->second, it->second.begin() );
+                }
+                else
+                    it->second.pop_front();
+            }
+            it = _largepowers.erase(it);
+        }
+    }
+
+private:
+    struct prime_t
+    {
+        prime_t(integer_t _p = 0, integer_t _n = 0)
+            : p(_p), n(_n)
+        {}
+        integer_t p, n;
+    };
+    struct primepower_t
+    {
+        primepower_t(integer_t _p = 0, integer_t _q = 0, integer_t _n = 0)
+            : p(_p), q(_q), n(_n)
+        {}
+        integer_t p, q, n;
+    };
+
+    static const size_t basechunk = size_t(1) << 22;
+    // the power cursors insert the powers ahead of the walk up to this distance at once
+    static const size_t powerhorizon = size_t(1) << 24;
+
+    integer_t _pmax, _begin, _offset, _ub;
+    std::vector<integer_t> _skip;
+    range_sieve _basegen;
+    integer_t _basenext; // all base primes < _basenext have been activated
+    std::vector<integer_t> _baseprimes;
+    std::vector<prime_t> _smallprimes;
+    std::vector<primepower_t> _smallpowers;
+    basic_bucket_ring<uint32_t> _primering, _powerring;
+    std::vector< std::pair<uint32_t, uint32_t> > _powers; // (p, q) of the bucketed prime powers
+    std::map< integer_t, std::list<primepower_t> > _largepowers;
+    // all powers p^e in [max(pmax, segment_indices, begin), _powernext[e]) have been inserted, _powernext[e] = _powerroot[e]^e
+    integer_t _powerroot[64], _powernext[64], _powermin;
+
+    // prime powers >= max(pmax, segment_indices) are kept in the map
+    integer_t _largelb() const { return std::max<integer_t>(_pmax, segment_indices); }
+
+    // x^e saturated at 2^64-1
+    static integer_t _pow(integer_t x, unsigned e)
+    {
+        integer_t r = 1;
+        for (unsigned j = 0; j < e; ++j)
+        {
+            if (x != 0 && r > ~integer_t(0) / x)
+                return ~integer_t(0);
+            r *= x;
+        }
+        return r;
+    }
+
+    // smallest r with r^e >= x
+    static integer_t _iroot_ceil(integer_t x, unsigned e)
+    {
+        integer_t r = integer_t(std::pow(double(x), 1.0 / double(e)));
+        while (r > 0 && _pow(r - 1, e) >= x)
+            --r;
+        while (_pow(r, e) < x)
+            ++r;
+        return r;
+    }
+
+    // activate (at least) all base primes p < ub at their first (odd) multiple >= offset
+    void _activate(integer_t offset, integer_t ub)
+    {
+        ub = std::min(ub, _pmax);
+        while (_basenext < ub)
+        {
+            // primes ahead of the walk first hit n = p < pmax, which fits in the bucket rings
+            const integer_t chunkend = std::min<integer_t>(_basenext + basechunk, _pmax);
+            _baseprimes.clear();
+            _basegen.genprimes(_basenext, chunkend, [this](integer_t p){ _baseprimes.emplace_back(p); });
+            _basenext = chunkend;
+            for (auto p : _baseprimes)
+            {
+                if (Odd && p == 2)
+                    continue;
+                integer_t n = first_multiple(p, offset);
+                if (n >= _ub || std::find(_skip.begin(), _skip.end(), p) != _skip.end())
+                    ;
+                else if (p < segment_indices)
+                    _smallprimes.emplace_back(p, n);
+                else
+                    _primering.push(offset / segment_size, uint32_t(p), (n - offset) / stride);
+                for (integer_t q = p; q <= (_ub - 1) / p; )
+                {
+                    q *= p;
+                    if (q >= _largelb() && q >= _begin)
+                        break; // inserted by the power cursors
+                    n = first_multiple(q, offset);
+                    if (n >= _ub)
+                        continue;
+                    if (q < segment_indices)
+                        _smallpowers.emplace_back(p, q, n);
+                    else if (q < _pmax)
+                    {
+                        _powerring.push(offset / segment_size, uint32_t(_powers.size()), (n - offset) / stride);
+                        _powers.emplace_back(uint32_t(p), uint32_t(q));
+                    }
+                    else
+                        _largepowers[n].emplace_back(p, q, n);
+                }
+            }
+        }
+    }
+
+    // insert the powers p^e >= max(pmax, segment_indices, begin) with p^e < ub
+    void _insert_powers(integer_t ub)
+    {
+        for (unsigned e = 2; e < 64; ++e)
+        {
+            if (_powernext[e] >= ub)
+                continue;
+            const integer_t r = std::min(_iroot_ceil(ub, e), _pmax);
+            _basegen.genprimes(_powerroot[e], r, [this, e](integer_t p)
+                {
+                    if (Odd && p == 2)
+                        return;
+                    const integer_t q = _pow(p, e);
+                    _largepowers[q].emplace_back(p, q, q);
+                });
+            _powerroot[e] = r;
+            _powernext[e] = r >= _pmax ? ~integer_t(0) : _pow(r, e);
+        }
+        _powermin = *std::min_element(_powernext, _powernext + 64);
+    }
+};
+
+// A segmented sieve for multiplicative and additive arithmetic functions on [lb,ub)
+// Works like almost_prime_sieve, but over all integers instead of only odd integers:
+// - every prime p < sqrt(ub) and its powers 'walk' over the segments, see prime_walker
+// - for every integer we keep factor counters and a cumulative product of the walked primes
+// - the cumulative product differs from the integer <=> it has exactly 1 prime factor >= sqrt(ub): integer / product
+// The Fields template argument selects which per-integer values are computed
+
+class multiplicative_sieve
+{
+public:
+    typedef std::uint64_t integer_t;
+    typedef std::uint8_t count_t;
+    typedef std::size_t size_t;
+
+    static const size_t segment_size = prime_walker<false>::segment_size;
+
+    enum fields_t : unsigned
+    {
+        f_omega  = 1,  // omega: number of distinct prime factors (also needed for mu)
+        f_Omega  = 2,  // Omega: number of prime factors with multiplicity (always computed)
+        f_phi    = 4,  // Euler's totient
+        f_spf    = 8,  // smallest prime factor
+        f_lpf    = 16, // largest prime factor
+        f_factors= 32, // all prime factors with multiplicity, see segment_t::factors
+        f_all    = 63
+    };
+
+    // all computed values for the integers n in [lb,ub) of one segment, indexed by i = n - offset
+    struct segment_t
+    {
+        integer_t offset;
+        size_t begin, end; // valid indices: [begin, end)
+        std::vector< count_t > omega, Omega;
+        std::vector< integer_t > product, phi, spf, lpf;
+        // walked prime factors of each integer as linked lists: factorhead[i]-1 is index of first entry in factorprime
+        std::vector< uint32_t > factorhead, factornext, factorprime;
+
+        integer_t n(size_t i) const { return offset + i; }
+        // Moebius mu: 0 if not squarefree, otherwise (-1)^omega
+        int mu(size_t i) const { return omega[i] != Omega[i] ? 0 : (Omega[i] & 1 ? -1 : 1); }
+        // Liouville lambda: (-1)^Omega
+        int lambda(size_t i) const { return (Omega[i] & 1) ? -1 : 1; }
+
+        // set f to all prime factors of n(i) with multiplicity in increasing order
+        void factors(size_t i, std::vector<integer_t>& f) const
+        {
+            f.clear();
+            for (uint32_t j = factorhead[i]; j != 0; j = factornext[j-1])
+                f.emplace_back(factorprime[j-1]);
+            if (product[i] != n(i))
+                f.emplace_back(n(i) / product[i]);
+            std::sort(f.begin(), f.end());
+        }
+
+        inline void _addfactor(size_t i, uint32_t p)
+        {
+            factorprime.emplace_back(p);
+            factornext.emplace_back(factorhead[i]);
+            factorhead[i] = uint32_t(factorprime.size());
+        }
+    };
+
+private:
+    integer_t _maxval;
+
+    // walked prime (powers) dividing the integer with index i of segment s
+    // the value arrays are held as raw pointers, so that the walk keeps them in registers
+    template<unsigned Fields>
+    struct hit_t
+    {
+        count_t *omega, *Omega;
+        integer_t *product, *phi, *spf, *lpf;
+        segment_t* s;
+
+        hit_t(segment_t& _s)
+            : omega(_s.omega.data()), Omega(_s.Omega.data()), product(_s.product.data())
+            , phi(_s.phi.data()), spf(_s.spf.data()), lpf(_s.lpf.data()), s(&_s)
+        {}
+
+        // prime p divides s.n(i)
+        inline void prime(size_t i, integer_t p) const
+        {
+            if (Fields & f_omega) ++omega[i];
+            if (Fields & f_Omega) ++Omega[i];
+            product[i] *= p;
+            if (Fields & f_phi) phi[i] *= p - 1;
+            if (Fields & f_spf) spf[i] = std::min(spf[i], p);
+            if (Fields & f_lpf) lpf[i] = std::max(lpf[i], p);
+            if (Fields & f_factors) s->_addfactor(i, uint32_t(p));
+        }
+
+        // prime power q = p^k with k > 1 divides s.n(i)
+        inline void power(size_t i, integer_t p) const
+        {
+            if (Fields & f_Omega) ++Omega[i];
+            product[i] *= p;
+            if (Fields & f_phi) phi[i] *= p;
+            if (Fields & f_factors) s->_addfactor(i, uint32_t(p));
+        }
+    };
+
+public:
+    // prepare sieve for all integers < maxval
+    multiplicative_sieve(integer_t maxval)
+        : _maxval(maxval)
+    {
+    }
+
+    integer_t maxval() const { return _maxval; }
+
+    // sieve [lb,ub) and call callback(const segment_t&) for each consecutive segment
+    // thread-safe: all sieve state is local
+    template<unsigned Fields = f_all, typename F>
+    void sieve(integer_t lb, integer_t ub, F&& callback) const
+    {
+        if (ub > _maxval)
+            throw std::runtime_error("multiplicative_sieve::sieve: ub > maxval");
+        if (lb == 0)
+            lb = 1;
+        if (ub <= lb)
+            return;
+
+        segment_t s;
+        s.offset = (lb / segment_size) * segment_size;
+        s.product.resize(segment_size);
+        s.Omega.resize(segment_size);
+        if (Fields & f_omega) s.omega.resize(segment_size);
+        if (Fields & f_phi) s.phi.resize(segment_size);
+        if (Fields & f_spf) s.spf.resize(segment_size);
+        if (Fields & f_lpf) s.lpf.resize(segment_size);
+        if (Fields & f_factors) s.factorhead.resize(segment_size);
+
+        // walk the primes p < sqrt(ub)
+        const hit_t<Fields | f_Omega> hit(s);
+        prime_walker<false> walker;
+        walker.reset(ceil_sqrt(ub), s.offset / segment_size, ub);
+
+        for (; s.offset < ub; s.offset += segment_size)
+        {
+            s.begin = lb > s.offset ? lb - s.offset : 0;
+            s.end = std::min<integer_t>(ub - s.offset, segment_size);
+
+            // reset all values
+            std::fill(s.product.begin(), s.product.end(), 1);
+            std::fill(s.Omega.begin(), s.Omega.end(), 0);
+            if (Fields & f_omega) std::fill(s.omega.begin(), s.omega.end(), 0);
+            if (Fields & f_phi) std::fill(s.phi.begin(), s.phi.end(), 1);
+            if (Fields & f_spf) std::fill(s.spf.begin(), s.spf.end(), ~integer_t(0));
+            if (Fields & f_lpf) std::fill(s.lpf.begin(), s.lpf.end(), 1);
+            if (Fields & f_factors)
+            {
+                std::fill(s.factorhead.begin(), s.factorhead.end(), 0);
+                s.factornext.clear();
+                s.factorprime.clear();
+            }
+
+            walker.walk(hit);
+
+            // integers that differ from their current factor product have exactly one large prime factor r >= sqrt(ub)
+            // through the raw pointers of hit and local bounds, as the counter stores may alias s otherwise
+            const integer_t offset = s.offset;
+            for (size_t i = s.begin, end = s.end; i < end; ++i)
+            {
+                integer_t n = offset + i;
+                if (hit.product[i] == n)
+                {
+                    if ((Fields & f_spf) && n == 1) hit.spf[i] = 1;
+                    continue;
+                }
+                if (Fields & f_omega) ++hit.omega[i];
+                ++hit.Omega[i];
+                if (Fields & (f_phi | f_spf | f_lpf))
+                {
+                    integer_t r = n / hit.product[i];
+                    if (Fields & f_phi) hit.phi[i] *= r - 1;
+                    if (Fields & f_spf) hit.spf[i] = std::min(hit.spf[i], r);
+                    if (Fields & f_lpf) hit.lpf[i] = r;
+                }
+            }
+
+            callback(static_cast<const segment_t&>(s));
+        }
+    }
+
+    // parallel reduction over [lb,ub): the range is split in consecutive blocks of segments, one per thread
+    // each thread calls its own copy of state on its segments, afterwards combine(result, threadstate) is called in order
+    template<unsigned Fields = f_all, typename State, typename Combine>
+    State reduce(integer_t lb, integer_t ub, const State& state, Combine&& combine, unsigned threads = 1) const
+    {
+        if (lb == 0)
+            lb = 1;
+        if (threads == 0)
+            threads = 1;
+        std::vector<State> states(threads, state);
+        std::vector<std::thread> workers;
+        integer_t segments = ub > lb ? (ub - 1) / segment_size - lb / segment_size + 1 : 0;
+        integer_t firstsegment = lb / segment_size;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            integer_t segbegin = firstsegment + (segments/threads)*t + std::min<integer_t>(t, segments%threads);
+            integer_t segend = segbegin + segments/threads + (t < segments%threads ? 1 : 0);
+            integer_t tlb = std::max(lb, segbegin * segment_size), tub = std::min(ub, segend * segment_size);
+            State* tstate = &states[t];
+            workers.emplace_back([this, t, tlb, tub, tstate](){ numa_bind_worker(t); this->sieve<Fields>(tlb, tub, *tstate); });
+        }
+        for (auto& w : workers)
+            w.join();
+        State result = state;
+        for (auto& s : states)
+            combine(result, s);
+        return result;
+    }
+
+    // Mertens function M(x) = sum_{1 <= n <= x} mu(n)
+    int64_t mertens(integer_t x, unsigned threads = 1) const
+    {
+        struct state_t
+        {
+            int64_t sum;
+            void operator()(const segment_t& s)
+            {
+                for (size_t i = s.begin; i < s.end; ++i)
+                    sum += s.mu(i);
+            }
+        };
+        state_t init = { 0 };
+        return reduce<f_omega | f_Omega>(1, x+1, init, [](state_t& r, const state_t& s){ r.sum += s.sum; }, threads).sum;
+    }
+
+    // summatory Liouville function L(x) = sum_{1 <= n <= x} lambda(n)
+    int64_t liouville(integer_t x, unsigned threads = 1) const
+    {
+        struct state_t
+        {
+            int64_t sum;
+            void operator()(const segment_t& s)
+            {
+                for (size_t i = s.begin; i < s.end; ++i)
+                    sum += s.lambda(i);
+            }
+        };
+        state_t init = { 0 };
+        return reduce<f_Omega>(1, x+1, init, [](state_t& r, const state_t& s){ r.sum += s.sum; }, threads).sum;
+    }
+
+    // call callback(n, factors) for each n in [lb,ub) with all prime factors of n with multiplicity in increasing order
+    template<typename F>
+    void factorize(integer_t lb, integer_t ub, F&& callback) const
+    {
+        std::vector<integer_t> f;
+        sieve<f_factors>(lb, ub, [&](const segment_t& s)
+            {
+                for (size_t i = s.begin; i < s.end; ++i)
+                {
+                    s.factors(i, f);
+                    callback(s.n(i), static_cast<const std::vector<integer_t>&>(f));
+                }
+            });
+    }
+
+    // factor a batch of arbitrary integers 0 < n < maxval: queries are sorted and clustered,
+    // each cluster of nearby queries is answered by one sweep over its segments
+    // calls callback(n, factors) for each distinct query n in increasing order
+    template<typename F>
+    void factorize_batch(std::vector<integer_t> queries, F&& callback) const
+    {
+        // start new sweep when the gap between queries is larger than this number of segments
+        const integer_t maxgap = 64 * segment_size;
+        std::sort(queries.begin(), queries.end());
+        queries.erase(std::unique(queries.begin(), queries.end()), queries.end());
+        if (!queries.empty() && queries.front() == 0)
+            throw std::runtime_error("multiplicative_sieve::factorize_batch: cannot factor 0");
+        if (!queries.empty() && queries.back() >= _maxval)
+            throw std::runtime_error("multiplicative_sieve::factorize_batch: query >= maxval");
+        std::vector<integer_t> f;
+        for (size_t begin = 0, end = 0; begin < queries.size(); begin = end)
+        {
+            end = begin + 1;
+            while (end < queries.size() && queries[end] - queries[end-1] <= maxgap)
+                ++end;
+            auto it = queries.begin() + begin;
+            sieve<f_factors>(queries[begin], queries[end-1] + 1, [&](const segment_t& s)
+                {
+                    for (; it != queries.begin() + end && *it < s.offset + s.end; ++it)
+                    {
+                        s.factors(*it - s.offset, f);
+                        callback(*it, static_cast<const std::vector<integer_t>&>(f));
+                    }
+                });
+        }
+    }
+
+    // distribution of omega and Omega over [lb,ub): result[0][k] = #{n: omega(n)=k}, result[1][k] = #{n: Omega(n)=k}
+    std::vector< std::vector<integer_t> > omega_distribution(integer_t lb, integer_t ub, unsigned threads = 1) const
+    {
+        struct state_t
+        {
+            std::vector< std::vector<integer_t> > counts;
+            void operator()(const segment_t& s)
+            {
+                for (size_t i = s.begin; i < s.end; ++i)
+                {
+                    ++counts[0][s.omega[i]];
+                    ++counts[1][s.Omega[i]];
+                }
+            }
+        };
+        state_t init;
+        init.counts.assign(2, std::vector<integer_t>(65, 0));
+        return reduce<f_omega | f_Omega>(lb, ub, init, [](state_t& r, const state_t& s)
+            {
+                for (size_t j = 0; j < 2; ++j)
+                    for (size_t k = 0; k < r.counts[j].size(); ++k)
+                        r.counts[j][k] += s.counts[j][k];
+            }, threads).counts;
+    }
+};
+
+// writes factorizations to a compact binary file, use as callback for factorize(lb, ub, callback)
+// and call flush() afterwards: the destructor does not write, so write errors are never lost
+// format: for each consecutive n: 1 byte with the number k of prime factors (with multiplicity)
+//         followed by k primes in increasing order each as LEB128 varint (7 bits per byte, high bit = more bytes follow)
+struct factor_writer
+{
+    FILE* _fd;
+    std::vector<unsigned char> _buf;
+
+    factor_writer(FILE* fd) : _fd(fd) {}
+
+    void operator()(uint64_t, const std::vector<uint64_t>& f)
+    {
+        _buf.emplace_back((unsigned char)(f.size()));
+        for (uint64_t p : f)
+        {
+            for (; p >= 0x80; p >>= 7)
+                _buf.emplace_back((unsigned char)(p | 0x80));
+            _buf.emplace_back((unsigned char)(p));
+        }
+        if (_buf.size() >= (1<<20))
+            flush();
+    }
+
+    void flush()
+    {
+        if (!_buf.empty() && fwrite(&_buf[0], 1, _buf.size(), _fd) != _buf.size())
+            throw std::runtime_error("factor_writer: write error");
+        _buf.clear();
+    }
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,248 @@
+/*********************************************************************************\
+*                                                                                 *
+* https://github.com/cr-marcstevens/primegen                                      *
+*                                                                                 *
+* MIT License                                                                     *
+*                                                                                 *
+* Copyright (c) 2021 Marc Stevens                                                 *
+*                                                                                 *
+* Permission is hereby granted, free of charge, to any person obtaining a copy    *
+* of this software and associated documentation files (the "Software"), to deal   *
+* in the Software without restriction, including without limitation the rights    *
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell       *
+* copies of the Software, and to permit persons to whom the Software is           *
+* furnished to do so, subject to the following conditions:                        *
+*                                                                                 *
+* The above copyright notice and this permission notice shall be included in all  *
+* copies or substantial portions of the Software.                                 *
+*                                                                                 *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR      *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,        *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE     *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER          *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,   *
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE   *
+* SOFTWARE.                                                                       *
+*                                                                                 *
+\*********************************************************************************/
+
+#ifndef PRIME_TABLE_HPP
+#define PRIME_TABLE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PRIME_TABLE_MMAP
+#endif
+
+#include "primegen.hpp"
+
+#ifdef __SIZEOF_INT128__
+
+namespace primegen
+{
+
+// Checkpoint table of pi(x) and the prime sums at x = k*2^s for k = 0, 1, ..., entries-1
+// - the table is built once with a parallel range sieve and stored in a binary file
+// - the file is loaded with mmap (or read into memory where mmap is not available)
+// - count(lb,ub) and sum(lb,ub) need two table lookups and sieving at most two partial intervals of < 2^s numbers
+// File format (native byte order): header_t followed by entries of entry_t
+class prime_table
+{
+public:
+    struct header_t
+    {
+        char magic[8];       // "PGPITBL1"
+        uint64_t log2interval; // s
+        uint64_t entries;
+        uint64_t reserved;
+    };
+    struct entry_t
+    {
+        uint64_t count;      // pi(k*2^s - 1): number of primes < k*2^s
+        uint64_t sumlo, sumhi; // sum of primes < k*2^s
+    };
+
+    prime_table() : _entries(nullptr), _header(nullptr), _map(nullptr), _mapsize(0) {}
+    prime_table(const std::string& filename) : prime_table() { load(filename); }
+    ~prime_table() { _unload(); }
+    prime_table(const prime_table&) = delete;
+    prime_table& operator=(const prime_table&) = delete;
+
+    // build table with checkpoints k*2^s for all k*2^s <= ub and write it to filename
+    static void build(const std::string& filename, uint64_t ub, unsigned log2interval, unsigned threads = 1)
+    {
+        if (log2interval < 7 || log2interval > 63)
+            throw std::runtime_error("prime_table: interval must be 2^s with 7 <= s <= 63");
+        if (threads == 0)
+            threads = 1;
+        const uint64_t intervals = ub >> log2interval;
+        // number and sum of primes in each interval [k*2^s, (k+1)*2^s), sieved in consecutive blocks, one per thread
+        std::vector<uint64_t> counts(intervals, 0);
+        std::vector<uint128_t> sums(intervals, 0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            const uint64_t kbegin = (intervals/threads)*t + std::min<uint64_t>(t, intervals%threads);
+            const uint64_t kend = kbegin + intervals/threads + (t < intervals%threads ? 1 : 0);
+            workers.emplace_back([t, kbegin, kend, log2interval, &counts, &sums]()
+                {
+                    if (kbegin == kend)
+                        return;
+                    numa_bind_worker(t);
+                    range_sieve rs;
+                    rs.genprimes(kbegin << log2interval, kend << log2interval, [&](uint64_t p)
+                        {
+                            ++counts[p >> log2interval];
+                            sums[p >> log2interval] += p;
+                        });
+                });
+        }
+        for (auto& w : workers)
+            w.join();
+
+        header_t header;
+        memcpy(header.magic, "PGPITBL1", 8);
+        header.log2interval = log2interval;
+        header.entries = intervals + 1;
+        header.reserved = 0;
+        FILE* fd = fopen(filename.c_str(), "wb");
+        if (fd == nullptr)
+            throw std::runtime_error("prime_table: could not open file for writing: " + filename);
+        bool ok = fwrite(&header, sizeof(header), 1, fd) == 1;
+        uint64_t count = 0;
+        uint128_t sum = 0;
+        for (uint64_t k = 0; k <= intervals && ok; ++k)
+        {
+            const entry_t e = { count, uint64_t(sum), uint64_t(sum >> 64) };
+            ok = fwrite(&e, sizeof(e), 1, fd) == 1;
+            if (k < intervals)
+            {
+                count += counts[k];
+                sum += sums[k];
+            }
+        }
+        if (fclose(fd) != 0 || !ok)
+            throw std::runtime_error("prime_table: could not write file: " + filename);
+    }
+
+    void load(const std::string& filename)
+    {
+        _unload();
+#ifdef PRIME_TABLE_MMAP
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+            throw std::runtime_error("prime_table: could not open file: " + filename);
+        _mapsize = size_t(st.st_size);
+        void* map = _mapsize >= sizeof(header_t) ? mmap(nullptr, _mapsize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (map == MAP_FAILED)
+            throw std::runtime_error("prime_table: could not map file: " + filename);
+        _map = map;
+        _header = static_cast<const header_t*>(_map);
+#else
+        FILE* fd = fopen(filename.c_str(), "rb");
+        if (fd == nullptr)
+            throw std::runtime_error("prime_table: could not open file: " + filename);
+        std::vector<char> data;
+        char buf[1<<16];
+        for (size_t r; (r = fread(buf, 1, sizeof(buf), fd)) > 0; )
+            data.insert(data.end(), buf, buf + r);
+        fclose(fd);
+        _data.resize((data.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        if (!data.empty())
+            memcpy(&_data[0], &data[0], data.size());
+        _mapsize = data.size();
+        _header = reinterpret_cast<const header_t*>(_data.data());
+#endif
+        if (_mapsize < sizeof(header_t) || memcmp(_header->magic, "PGPITBL1", 8) != 0
+            || _header->entries == 0 || _mapsize < sizeof(header_t) + _header->entries * sizeof(entry_t))
+        {
+            _unload();
+            throw std::runtime_error("prime_table: invalid table file: " + filename);
+        }
+        _entries = reinterpret_cast<const entry_t*>(_header + 1);
+    }
+
+    bool loaded() const { return _entries != nullptr; }
+    unsigned log2interval() const { return unsigned(_header->log2interval); }
+    uint64_t entries() const { return _header->entries; }
+    // largest checkpoint
+    uint64_t limit() const { return (_header->entries - 1) << _header->log2interval; }
+    // largest bound for count and sum queries: at most one interval beyond the last checkpoint is sieved
+    uint64_t maxquery() const
+    {
+        const uint64_t interval = uint64_t(1) << _header->log2interval;
+        return limit() > ~uint64_t(0) - interval ? ~uint64_t(0) : limit() + interval;
+    }
+
+    // number of primes in [lb,ub), throws std::out_of_range for ub > maxquery()
+    uint64_t count(uint64_t lb, uint64_t ub)
+    {
+        if (ub <= lb)
+            return 0;
+        return _prefix(ub).first - _prefix(lb).first;
+    }
+
+    // sum of primes in [lb,ub), throws std::out_of_range for ub > maxquery()
+    uint128_t sum(uint64_t lb, uint64_t ub)
+    {
+        if (ub <= lb)
+            return 0;
+        return _prefix(ub).second - _prefix(lb).second;
+    }
+
+private:
+    const entry_t* _entries;
+    const header_t* _header;
+    void* _map;
+    size_t _mapsize;
+    std::vector<uint64_t> _data;
+    range_sieve _rs;
+
+    void _unload()
+    {
+#ifdef PRIME_TABLE_MMAP
+        if (_map != nullptr)
+            munmap(_map, _mapsize);
+#endif
+        _map = nullptr;
+        _mapsize = 0;
+        _data.clear();
+        _header = nullptr;
+        _entries = nullptr;
+    }
+
+    // number and sum of primes < x: nearest checkpoint <= x plus sieving the remainder
+    std::pair<uint64_t, uint128_t> _prefix(uint64_t x)
+    {
+        if (_entries == nullptr)
+            throw std::runtime_error("prime_table: no table loaded");
+        if (x > maxquery())
+            throw std::out_of_range("prime_table: query bound " + std::to_string(x) + " beyond table limit " + std::to_string(maxquery()));
+        const uint64_t k = std::min<uint64_t>(x >> _header->log2interval, _header->entries - 1);
+        const entry_t& e = _entries[k];
+        uint64_t count = e.count;
+        uint128_t sum = (uint128_t(e.sumhi) << 64) | e.sumlo;
+        _rs.genprimes(k << _header->log2interval, x, [&count, &sum](uint64_t p){ ++count; sum += p; });
+        return std::make_pair(count, sum);
+    }
+};
+
+} // namespace
+
+#endif // __SIZEOF_INT128__
+
+#endif // PRIME_TABLE_HPP
@@ -26,58 +26,1023 @@
 *                                                                                 *
 \*********************************************************************************/
 
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <cctype>
+#if (defined(__unix__) || defined(__APPLE__)) && defined(__SIZEOF_INT128__)
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define PRIMEGEN_SERVER
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#define PRIMEGEN_PWRITE
+#endif
+
 #include "primegen.hpp"
+#include "prime_table.hpp"
 #include "program_options.hpp"
 
 namespace pg = primegen;
 namespace po = program_options;
 
+#ifdef __SIZEOF_INT128__
+typedef pg::uint128_t bigint_t;
+#else
+typedef uint64_t bigint_t;
+#endif
+
+// parse unsigned integer expression with +, -, * and ^, e.g. "2^70+10^10"
+bigint_t parse_bigint(const std::string& str)
+{
+    size_t pos = 0;
+    auto number = [&]() -> bigint_t
+        {
+            if (pos >= str.size() || !isdigit(str[pos]))
+                throw std::runtime_error("Could not parse number: " + str);
+            bigint_t x = 0;
+            for (; pos < str.size() && isdigit(str[pos]); ++pos)
+            {
+                if (x > (~bigint_t(0) - 9) / 10)
+                    throw std::runtime_error("Number too large: " + str);
+                x = x * 10 + (str[pos] - '0');
+            }
+            return x;
+        };
+    auto factor = [&]() -> bigint_t
+        {
+            bigint_t x = number();
+            if (pos < str.size() && str[pos] == '^')
+            {
+                ++pos;
+                bigint_t e = number(), r = 1;
+                for (; e > 0; --e)
+                {
+                    if (x != 0 && r > ~bigint_t(0) / x)
+                        throw std::runtime_error("Number too large: " + str);
+                    r *= x;
+                }
+                x = r;
+            }
+            return x;
+        };
+    auto term = [&]() -> bigint_t
+        {
+            bigint_t x = factor();
+            while (pos < str.size() && str[pos] == '*')
+            {
+                ++pos;
+                bigint_t y = factor();
+                if (y != 0 && x > ~bigint_t(0) / y)
+                    throw std::runtime_error("Number too large: " + str);
+                x *= y;
+            }
+            return x;
+        };
+    bigint_t x = term();
+    while (pos < str.size() && (str[pos] == '+' || str[pos] == '-'))
+    {
+        bool add = str[pos++] == '+';
+        bigint_t y = term();
+        if (add ? (x + y < x) : (y > x))
+            throw std::runtime_error("Number out of range: " + str);
+        x = add ? x + y : x - y;
+    }
+    if (pos != str.size())
+        throw std::runtime_error("Could not parse number: " + str);
+    return x;
+}
+
+std::string to_string(bigint_t x)
+{
+    std::string str;
+    do
+    {
+        str.insert(str.begin(), char('0' + int(x % 10)));
+        x /= 10;
+    } while (x != 0);
+    return str;
+}
+
+// parse shard specification "i/N" with 0 <= i < N
+bool parse_shard(const std::string& str, size_t& shard, size_t& shards)
+{
+    char c = 0;
+    std::stringstream strstr(str);
+    strstr >> shard >> c >> shards;
+    return !!strstr && c == '/' && shard < shards;
+}
+
+// deterministic slice [shardlb,shardub) of shard i/N of [lb,ub): the first (ub-lb)%N shards are one number larger
+void shard_range(size_t lb, size_t ub, size_t shard, size_t shards, size_t& shardlb, size_t& shardub)
+{
+    size_t len = ub - lb;
+    shardlb = lb + (len/shards)*shard + std::min(shard, len%shards);
+    shardub = shardlb + len/shards + (shard < len%shards ? 1 : 0);
+}
+
+// combine partial results of shards 0..N-1 written with '--shard i/N -s'
+int merge(const std::vector<std::string>& files)
+{
+    size_t shards = 0, pcnt = 0, psum = 0;
+    bool overflow = false;
+    // [begin,end) of each shard by shard index: empty shards of a short range share their begin
+    std::map<size_t, std::pair<size_t,size_t> > ranges;
+    for (auto& file : files)
+    {
+        std::ifstream ifs(file.c_str());
+        if (!ifs)
+            throw std::runtime_error("Could not open file: " + file);
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            // line format: shard=i/N begin=lb end=ub count=c sum=s overflow=o
+            unsigned long long i, n, b, e, c, s;
+            int o;
+            if (sscanf(line.c_str(), "shard=%llu/%llu begin=%llu end=%llu count=%llu sum=%llu overflow=%d", &i, &n, &b, &e, &c, &s, &o) != 7)
+                continue;
+            if (shards == 0)
+                shards = n;
+            if (n != shards || i >= n)
+                throw std::runtime_error("Inconsistent shard: " + line);
+            if (!ranges.emplace(i, std::make_pair(b, e)).second)
+                throw std::runtime_error("Duplicate shard: " + line);
+            pcnt += c;
+            psum += s;
+            if (psum < s || o != 0)
+                overflow = true;
+        }
+    }
+    if (shards == 0 || ranges.size() != shards)
+        throw std::runtime_error("Missing shards: found " + std::to_string(ranges.size()) + " of " + std::to_string(shards));
+    // check that the shard ranges are exactly the slices of [begin,end) of the first and last shard
+    const size_t lb = ranges.begin()->second.first, ub = ranges.rbegin()->second.second;
+    for (auto& r : ranges)
+    {
+        size_t shardlb, shardub;
+        shard_range(lb, ub, r.first, shards, shardlb, shardub);
+        if (ub < lb || r.second.first != shardlb || r.second.second != shardub)
+            throw std::runtime_error("Shard " + std::to_string(r.first) + " does not match its slice of [" + std::to_string(lb) + "," + std::to_string(ub) + ")");
+    }
+    if (overflow)
+        std::cerr << "Warning: sum overflow in size_t" << std::endl;
+    std::cout << "count=" << pcnt << " sum=" << psum << std::endl;
+    return 0;
+}
+
+// generate primes in [lb,ub) directly or with the callback on this thread and the sieve on another thread
+template<typename Sieve, typename Int, typename F>
+void genprimes(Sieve& sieve, Int lb, Int ub, F&& callback, bool pipeline)
+{
+    if (pipeline)
+        pg::pipelined_genprimes(sieve, lb, ub, std::forward<F>(callback));
+    else
+        sieve.genprimes(lb, ub, std::forward<F>(callback));
+}
+
+// print primes in [lb,ub) or their number and sum
+template<typename Sieve>
+int run_range(Sieve& sieve, size_t lb, size_t ub, bool sum, bool pipeline)
+{
+    if (!sum)
+    {
+        genprimes(sieve, lb, ub, pg::printprime(), pipeline);
+    } else {
+        size_t psum = 0, pcnt = 0;
+        bool overflow = false;
+        genprimes(sieve, lb, ub, [&](size_t p){ ++pcnt; psum += p; if (psum < p) overflow = true; }, pipeline);
+        if (overflow)
+            std::cerr << "Warning: sum overflow in size_t" << std::endl;
+        std::cout << "count=" << pcnt << " sum=" << psum << std::endl;
+    }
+    return 0;
+}
+
+// primes in [lb,ub) for ranges beyond 2^64
+template<typename Int>
+int run_bigrange(Int lb, Int ub, bool sum, bool pipeline)
+{
+    pg::basic_range_sieve<Int> rs;
+    if (!sum)
+    {
+        genprimes(rs, lb, ub, pg::basic_printprime<Int>(), pipeline);
+    } else {
+        Int psum = 0;
+        size_t pcnt = 0;
+        bool overflow = false;
+        genprimes(rs, lb, ub, [&](Int p){ ++pcnt; psum += p; if (psum < p) overflow = true; }, pipeline);
+        if (overflow)
+            std::cerr << "Warning: sum overflow in 128-bit integer" << std::endl;
+        std::cout << "count=" << pcnt << " sum=" << to_string(psum) << std::endl;
+    }
+    return 0;
+}
+
+// parse list of numbers "0,2,6,..." for tuplet offsets and residues
+std::vector<size_t> parse_offsets(const std::string& str)
+{
+    std::vector<size_t> offsets;
+    std::istringstream strstr(str);
+    std::string tok;
+    while (std::getline(strstr, tok, ','))
+    {
+        if (tok.empty() || tok.find_first_not_of("0123456789") != std::string::npos)
+            throw std::runtime_error("Invalid list of numbers: " + str);
+        offsets.emplace_back(std::stoull(tok));
+    }
+    return offsets;
+}
+
+// prime k-tuplets and/or gap statistics of primes in [lb,ub) from the sieve words
+template<typename Int, typename Sieve>
+int run_wordstats(Sieve& sieve, Int lb, Int ub, const std::vector<size_t>& offsets, bool gaps, bool sum)
+{
+    pg::basic_tuplet_finder<Int> tuplets(offsets.empty() ? std::vector<size_t>(1, 0) : offsets);
+    pg::basic_gap_statistics<Int> gapstats;
+    pg::basic_printprime<Int> printer;
+    const bool print = !offsets.empty() && !sum;
+    sieve.genwords(lb, ub, [&](Int n, pg::prime_sieve::word_t x)
+        {
+            if (print)
+                tuplets(n, x, printer);
+            else if (!offsets.empty())
+                tuplets(n, x);
+            if (gaps)
+                gapstats(n, x);
+        });
+    if (print)
+    {
+        tuplets.finish(printer);
+        printer.flush();
+    }
+    else if (!offsets.empty())
+    {
+        tuplets.finish();
+        std::cout << "count=" << tuplets.count() << std::endl;
+    }
+    if (gaps)
+    {
+        for (size_t i = 0; i < gapstats.histogram().size(); ++i)
+            if (gapstats.histogram()[i] != 0)
+                std::cout << "gap=" << 2*i << " count=" << gapstats.histogram()[i] << std::endl;
+        for (auto& r : gapstats.records())
+            std::cout << "maxgap=" << r.second << " after=" << to_string(r.first) << std::endl;
+    }
+    return 0;
+}
+
+#ifdef __SIZEOF_INT128__
+// print the primes among the numbers in file (or stdin for "-"), one number per line
+int run_isprime(const std::string& filename)
+{
+    std::ifstream ifs;
+    if (filename != "-")
+    {
+        ifs.open(filename);
+        if (!ifs)
+            throw std::runtime_error("Could not open file: " + filename);
+    }
+    std::istream& is = (filename != "-") ? ifs : std::cin;
+    pg::primality_tester pt;
+    std::vector<uint64_t> batch;
+    std::vector<uint8_t> result;
+    std::string line;
+    while (is)
+    {
+        // read and test numbers in batches
+        batch.clear();
+        while (batch.size() < (1<<16) && std::getline(is, line))
+        {
+            if (line.empty())
+                continue;
+            const bigint_t n = parse_bigint(line);
+            if (n > ~uint64_t(0))
+                throw std::runtime_error("Number must be < 2^64: " + line);
+            batch.emplace_back(uint64_t(n));
+        }
+        result.resize(batch.size());
+        if (!batch.empty())
+            pt.test(&batch[0], batch.size(), &result[0]);
+        for (size_t i = 0; i < batch.size(); ++i)
+            if (result[i])
+                printf("%llu\n", (unsigned long long)batch[i]);
+    }
+    return 0;
+}
+#endif
+
+// answer count, sum and list queries from file (or stdin for "-"), one query "<count|sum|list> <lb> <ub>" per line
+// the query ranges are coalesced and each number in their union is sieved once:
+// count and sum queries are answered with prefix counts and sums at their endpoints
+int run_queries(const std::string& filename)
+{
+    std::ifstream ifs;
+    if (filename != "-")
+    {
+        ifs.open(filename);
+        if (!ifs)
+            throw std::runtime_error("Could not open file: " + filename);
+    }
+    std::istream& is = (filename != "-") ? ifs : std::cin;
+
+    struct query_t
+    {
+        std::string op;
+        size_t lb, ub;
+    };
+    std::vector<query_t> queries;
+    std::string line;
+    while (std::getline(is, line))
+    {
+        std::istringstream strstr(line);
+        std::string op, lbstr, ubstr;
+        if (!(strstr >> op))
+            continue;
+        if (!(strstr >> lbstr >> ubstr) || (op != "count" && op != "sum" && op != "list"))
+            throw std::runtime_error("Invalid query (expected <count|sum|list> <lb> <ub>): " + line);
+        const bigint_t lb = parse_bigint(lbstr), ub = parse_bigint(ubstr);
+        if (lb > ~size_t(0) || ub > ~size_t(0))
+            throw std::runtime_error("Query range must be below 2^64: " + line);
+        queries.push_back(query_t{ op, size_t(lb), std::max(size_t(lb), size_t(ub)) });
+    }
+
+    // coalesce all query ranges and the list query ranges
+    typedef std::pair<size_t,size_t> range_t;
+    auto coalesce = [](std::vector<range_t>& ranges)
+        {
+            std::sort(ranges.begin(), ranges.end());
+            std::vector<range_t> result;
+            for (auto& r : ranges)
+            {
+                if (r.first == r.second)
+                    continue;
+                if (!result.empty() && r.first <= result.back().second)
+                    result.back().second = std::max(result.back().second, r.second);
+                else
+                    result.push_back(r);
+            }
+            ranges.swap(result);
+        };
+    std::vector<range_t> ranges, listranges;
+    std::vector<size_t> endpoints;
+    for (auto& q : queries)
+    {
+        ranges.emplace_back(q.lb, q.ub);
+        if (q.op == "list")
+            listranges.emplace_back(q.lb, q.ub);
+        else
+        {
+            endpoints.push_back(q.lb);
+            endpoints.push_back(q.ub);
+        }
+    }
+    coalesce(ranges);
+    coalesce(listranges);
+    std::sort(endpoints.begin(), endpoints.end());
+    endpoints.erase(std::unique(endpoints.begin(), endpoints.end()), endpoints.end());
+
+    // sieve the union of all ranges once:
+    // record the number and sum of all sieved primes < e for each endpoint e and keep all primes in list ranges
+    std::vector<size_t> prefixcount(endpoints.size());
+    std::vector<bigint_t> prefixsum(endpoints.size());
+    std::vector<size_t> listprimes;
+    size_t pcnt = 0, nextendpoint = 0, nextlist = 0;
+    bigint_t psum = 0;
+    pg::range_sieve rs;
+    if (!ranges.empty())
+        rs.reserve(ranges.back().second);
+    for (auto& r : ranges)
+    {
+        rs.genprimes(r.first, r.second, [&](size_t p)
+            {
+                for (; nextendpoint < endpoints.size() && endpoints[nextendpoint] <= p; ++nextendpoint)
+                {
+                    prefixcount[nextendpoint] = pcnt;
+                    prefixsum[nextendpoint] = psum;
+                }
+                ++pcnt;
+                psum += p;
+                for (; nextlist < listranges.size() && listranges[nextlist].second <= p; ++nextlist)
+                    ;
+                if (nextlist < listranges.size() && listranges[nextlist].first <= p)
+                    listprimes.push_back(p);
+            });
+    }
+    for (; nextendpoint < endpoints.size(); ++nextendpoint)
+    {
+        prefixcount[nextendpoint] = pcnt;
+        prefixsum[nextendpoint] = psum;
+    }
+
+    // answer queries in input order
+    for (auto& q : queries)
+    {
+        if (q.op == "list")
+        {
+            auto it = std::lower_bound(listprimes.begin(), listprimes.end(), q.lb);
+            auto itend = std::lower_bound(it, listprimes.end(), q.ub);
+            for (bool first = true; it != itend; ++it, first = false)
+                printf(first ? "%llu" : " %llu", (unsigned long long)*it);
+            printf("\n");
+            continue;
+        }
+        const size_t i = size_t(std::lower_bound(endpoints.begin(), endpoints.end(), q.lb) - endpoints.begin());
+        const size_t j = size_t(std::lower_bound(endpoints.begin(), endpoints.end(), q.ub) - endpoints.begin());
+        if (q.op == "count")
+            printf("count=%llu\n", (unsigned long long)(prefixcount[j] - prefixcount[i]));
+        else
+            printf("count=%llu sum=%s\n", (unsigned long long)(prefixcount[j] - prefixcount[i]), to_string(prefixsum[j] - prefixsum[i]).c_str());
+    }
+    return 0;
+}
+
+#ifdef PRIMEGEN_PWRITE
+// write all len bytes of buf at offset pos, or at the current position if pos < 0
+bool write_all(int fd, const char* buf, size_t len, off_t pos)
+{
+    while (len > 0)
+    {
+        const ssize_t r = pos < 0 ? write(fd, buf, len) : pwrite(fd, buf, len, pos);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        buf += r;
+        len -= size_t(r);
+        if (pos >= 0)
+            pos += r;
+    }
+    return true;
+}
+
+// print primes in [lb,ub) to file (or stdout for "-") using several threads:
+// each thread sieves and formats chunks of the range into its own buffer, the byte offset of a chunk is the
+// running sum of the sizes of all previous chunks and the chunks are written concurrently with pwrite
+// (or in order with write if the output is not seekable, e.g. a pipe)
+template<typename Int>
+int run_output(const std::string& filename, Int lb, Int ub, size_t threads)
+{
+    // beyond 2^64 the range sieve regenerates its sieving primes for each chunk, so chunks are larger there
+    const uint64_t chunknumbers = uint64_t(1) << (ub > ~uint64_t(0) ? 28 : 24);
+    const int fd = filename == "-" ? 1 : open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    const off_t base = lseek(fd, 0, SEEK_CUR);
+    const bool seekable = base >= 0;
+    const uint64_t chunks = ub <= lb ? 0 : uint64_t((ub - lb - 1) / chunknumbers + 1);
+
+    std::atomic<uint64_t> nextchunk(0);
+    std::mutex mut;
+    std::condition_variable cond;
+    uint64_t turn = 0; // chunk whose offset is next
+    off_t offset = seekable ? base : 0;
+    bool failed = false;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < std::max<size_t>(threads, 1); ++t)
+        workers.emplace_back([&, t]()
+            {
+                pg::numa_bind_worker(unsigned(t));
+                pg::basic_range_sieve<Int> rs;
+                pg::basic_decimal_formatter<Int> format;
+                std::string buf;
+                for (uint64_t k; (k = nextchunk++) < chunks; )
+                {
+                    const Int a = lb + Int(k) * chunknumbers;
+                    const Int b = ub - a > chunknumbers ? a + chunknumbers : ub;
+                    buf.clear();
+                    rs.genprimes(a, b, [&](Int p)
+                        {
+                            const char* str = format(p);
+                            buf.append(str, format.size());
+                            buf.push_back('\n');
+                        });
+                    off_t pos;
+                    bool ok = true;
+                    {
+                        std::unique_lock<std::mutex> lock(mut);
+                        cond.wait(lock, [&]() { return turn == k || failed; });
+                        if (failed)
+                            return;
+                        pos = offset;
+                        offset += off_t(buf.size());
+                        if (!seekable)
+                            ok = write_all(fd, buf.data(), buf.size(), -1);
+                        failed = !ok;
+                        ++turn;
+                    }
+                    cond.notify_all();
+                    if (seekable)
+                        ok = write_all(fd, buf.data(), buf.size(), pos);
+                    if (!ok)
+                    {
+                        std::lock_guard<std::mutex> lock(mut);
+                        failed = true;
+                        cond.notify_all();
+                        return;
+                    }
+                }
+            });
+    for (auto& w : workers)
+        w.join();
+    // leave the file position of stdout after the output
+    if (!failed && seekable)
+        failed = lseek(fd, offset, SEEK_SET) < 0;
+    if ((fd != 1 && close(fd) != 0) || failed)
+        throw std::runtime_error("Could not write file: " + filename);
+    return 0;
+}
+#endif
+
+#ifdef PRIMEGEN_SERVER
+// prime query server on a Unix domain socket
+// requests are 24 bytes: uint32_t op, uint32_t reserved, uint64_t a, uint64_t b in native byte order
+// responses are uint64_t values in native byte order:
+//   op 1: is_prime(a)            -> 1 if a is prime, 0 otherwise
+//   op 2: next_prime(a)          -> smallest prime > a, or 0 if there is none < 2^64
+//   op 3: count primes in [a,b)  -> count
+//   op 4: list primes in [a,b)   -> count followed by count primes
+//   op 5: sum primes in [a,b)    -> low and high 64 bits of the sum
+// ops 3-5 with b-a > maxrange are rejected with an all-ones response: count ~0 (op 3 and 4), or ~0, ~0 (op 5)
+// a client may send many requests at once, responses are returned in order
+// clients are served one at a time, a client that stalls for timeout seconds is dropped
+// the base primes, prefilter and primality tester stay in memory between requests,
+// recently sieved segments are kept in an LRU cache with prefix counts
+class prime_server
+{
+public:
+    struct request_t
+    {
+        uint32_t op;
+        uint32_t reserved;
+        uint64_t a, b;
+    };
+
+    static const int timeout = 5;
+
+    prime_server(size_t cachebytes, uint64_t maxrange)
+        : _cache(cachebytes), _maxrange(maxrange)
+    {
+    }
+
+    int serve(const std::string& path)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("Socket path too long: " + path);
+        strcpy(addr.sun_path, path.c_str());
+        // only remove a stale socket, never any other file
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+            throw std::runtime_error("Could not listen on socket: " + path);
+        // warm up
+        _cache.count(0, 1<<20);
+        while (true)
+        {
+            int cfd = accept(fd, nullptr, nullptr);
+            if (cfd < 0)
+                continue;
+            timeval tv;
+            tv.tv_sec = timeout;
+            tv.tv_usec = 0;
+            setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            _handle(cfd);
+            close(cfd);
+        }
+        return 0;
+    }
+
+private:
+    pg::segment_cache _cache;
+    uint64_t _maxrange;
+    pg::primality_tester _pt;
+    std::vector<char> _in;
+    std::vector<uint64_t> _out, _cand;
+    std::vector<uint8_t> _res;
+
+    // primes in [a,b): small ranges are cheaper with the primality tester than with the sieve
+    template<typename F>
+    void _genprimes(uint64_t a, uint64_t b, F&& callback)
+    {
+        if (b <= a || b - a > (1<<12))
+        {
+            _cache.genprimes(a, b, callback);
+            return;
+        }
+        _cand.clear();
+        for (uint64_t n = a; n < b; ++n)
+            if (n == 2 || (n & 1) == 1)
+                _cand.push_back(n);
+        _res.resize(_cand.size());
+        if (!_cand.empty())
+            _pt.test(&_cand[0], _cand.size(), &_res[0]);
+        for (size_t i = 0; i < _cand.size(); ++i)
+            if (_res[i])
+                callback(_cand[i]);
+    }
+
+    uint64_t _next_prime(uint64_t a)
+    {
+        // test batches of odd candidates
+        uint64_t cand[64];
+        uint8_t res[64];
+        if (a < 2)
+            return 2;
+        for (uint64_t n = (a + 1) | 1; n > a; )
+        {
+            size_t k = 0;
+            for (; k < 64 && n > a; ++k, n += 2)
+                cand[k] = n;
+            _pt.test(cand, k, res);
+            for (size_t i = 0; i < k; ++i)
+                if (res[i])
+                    return cand[i];
+        }
+        return 0;
+    }
+
+    bool _flush(int cfd)
+    {
+        const char* buf = (const char*)_out.data();
+        size_t len = _out.size() * sizeof(uint64_t);
+        while (len > 0)
+        {
+            ssize_t w = write(cfd, buf, len);
+            if (w <= 0)
+                return false;
+            buf += w;
+            len -= size_t(w);
+        }
+        _out.clear();
+        return true;
+    }
+
+    void _handle(int cfd)
+    {
+        _in.clear();
+        char buf[1<<16];
+        while (true)
+        {
+            ssize_t r = read(cfd, buf, sizeof(buf));
+            if (r <= 0)
+                return;
+            _in.insert(_in.end(), buf, buf + r);
+            // answer all complete requests, then flush the responses
+            size_t i = 0;
+            for (; i + sizeof(request_t) <= _in.size(); i += sizeof(request_t))
+            {
+                request_t req;
+                memcpy(&req, &_in[i], sizeof(req));
+                if (req.op >= 3 && req.op <= 5 && req.b > req.a && req.b - req.a > _maxrange)
+                {
+                    _out.push_back(~uint64_t(0));
+                    if (req.op == 5)
+                        _out.push_back(~uint64_t(0));
+                    continue;
+                }
+                switch (req.op)
+                {
+                case 1:
+                    _out.push_back(_pt.is_prime(req.a) ? 1 : 0);
+                    break;
+                case 2:
+                    _out.push_back(_next_prime(req.a));
+                    break;
+                case 3:
+                {
+                    uint64_t count = 0;
+                    if (req.b > req.a && req.b - req.a > (1<<12))
+                        count = _cache.count(req.a, req.b);
+                    else
+                        _genprimes(req.a, req.b, [&count](uint64_t){ ++count; });
+                    _out.push_back(count);
+                    break;
+                }
+                case 4:
+                {
+                    size_t pos = _out.size();
+                    _out.push_back(0);
+                    _genprimes(req.a, req.b, [this](uint64_t p){ _out.push_back(p); });
+                    _out[pos] = _out.size() - pos - 1;
+                    break;
+                }
+                case 5:
+                {
+                    pg::uint128_t sum = 0;
+                    if (req.b > req.a && req.b - req.a > (1<<12))
+                        sum = _cache.sum(req.a, req.b);
+                    else
+                        _genprimes(req.a, req.b, [&sum](uint64_t p){ sum += p; });
+                    _out.push_back(uint64_t(sum));
+                    _out.push_back(uint64_t(sum >> 64));
+                    break;
+                }
+                default:
+                    // unknown request: drop connection
+                    return;
+                }
+            }
+            _in.erase(_in.begin(), _in.begin() + i);
+            if (!_flush(cfd))
+                return;
+        }
+    }
+};
+#endif
+
 int main(int argc, char** argv)
 {
     // command line interface
-    size_t lb = 1, ub = 0;
+    std::string lbstr = "1", ubstr = "0";
+    std::string shardstr, outputstr, randomstr, tupletstr, residuestr, modstr, isprimestr, servestr, maxrangestr = "2^30", queriesstr, tablestr, buildtablestr, enginestr, hugepages = "none";
+    size_t cachemb = 64, log2interval = 24, threads = std::thread::hardware_concurrency();
+    uint64_t seed = (uint64_t(std::random_device()()) << 32) ^ std::random_device()();
     po::options_description opts("Command line options");
     opts.add_options()
         ("help,h", "Show options")
-        ("begin,b", po::value<size_t>(&lb)->default_value(1), "Output primes >= begin")
-        ("end,e", po::value<size_t>(&ub), "Output primes < end")
+        ("begin,b", po::value<std::string>(&lbstr)->default_value("1"), "Output primes >= begin")
+        ("end,e", po::value<std::string>(&ubstr), "Output primes < end.\nBegin and end may be expressions like 2^70+10^10, values >= 2^64 use 128-bit sieving.")
         ("sum,s", "Print sum of all primes, instead of primes")
+        ("shard", po::value<std::string>(&shardstr), "Only process shard i/N of the range.\nCombine the outputs of all shards with '-s' using: primegen merge <files>")
+        ("pipeline", "Sieve on a separate thread while printing or summing the primes")
+        ("explain", "Print the chosen engine and the estimated time of each engine to stderr")
+        ("engine", po::value<std::string>(&enginestr), "Use the given engine instead of the cost model: dense, segmented, primality or analytic (only with '-s')")
+        ("threads,t", po::value<size_t>(&threads), "Number of threads for --build-table and --output")
+#ifdef __SIZEOF_INT128__
+        ("random", po::value<std::string>(&randomstr), "Print the given number of uniformly random primes in the range < 2^64")
+        ("seed", po::value<uint64_t>(&seed), "Seed for --random (default: random)")
+#endif
+#ifdef PRIMEGEN_PWRITE
+        ("output,o", po::value<std::string>(&outputstr), "Print primes to the given file (or stdout for '-') formatting them in parallel with --threads")
+#endif
+#ifdef __SIZEOF_INT128__
+        ("isprime", po::value<std::string>(&isprimestr), "Print the primes among the numbers < 2^64 in the given file (or stdin for '-'), one number per line")
+#endif
+#ifdef __SIZEOF_INT128__
+        ("build-table", po::value<std::string>(&buildtablestr), "Build table of prime counts and sums at multiples of 2^interval up to end and write it to the given file")
+        ("interval", po::value<size_t>(&log2interval)->default_value(24), "Log2 of interval between checkpoints of --build-table")
+        ("numa", "Best effort: pin threads of --build-table and --output round-robin to the CPUs of NUMA nodes, so their buffers are first touched on the local node (Linux only, no-op otherwise)")
+        ("table", po::value<std::string>(&tablestr), "Use table of --build-table for counts and sums with '-s'")
+#endif
+        ("hugepages", po::value<std::string>(&hugepages)->default_value("none"), "Huge pages for sieve buffers: none, 2m or 1g (Linux only)")
+        ("queries", po::value<std::string>(&queriesstr), "Answer queries '<count|sum|list> <lb> <ub>' from the given file (or stdin for '-'), one per line, sieving the union of their ranges once")
+#ifdef PRIMEGEN_SERVER
+        ("serve", po::value<std::string>(&servestr), "Serve prime queries on the given Unix domain socket (see README)")
+        ("cache", po::value<size_t>(&cachemb)->default_value(64), "Size in MiB of the segment cache of --serve")
+        ("maxrange", po::value<std::string>(&maxrangestr)->default_value("2^30"), "Maximal range size b-a of count, list and sum requests of --serve")
+#endif
+        ("twins", "Output first primes p of twin primes (p, p+2) or count them with '-s'")
+        ("tuplet", po::value<std::string>(&tupletstr), "Output first primes p of prime k-tuplets with given offsets, e.g. 0,2,6,8 for (p, p+2, p+6, p+8), or count them with '-s'")
+        ("mod", po::value<std::string>(&modstr), "Only primes in residue classes modulo m, with '-s' print the count per class")
+        ("residue", po::value<std::string>(&residuestr), "Residue classes for --mod, e.g. 1,3 (default: all classes coprime to m)")
+        ("gaps", "Print histogram of gaps between consecutive odd primes and the maximal gaps")
         ;
     po::variables_map vm;
     bool allow_unregistered = false, allow_positional = true;
     po::store(po::parse_command_line(argc, argv, opts, allow_unregistered, allow_positional), vm);
+    pg::memory_policy().pages = pg::parse_page_policy(hugepages);
+    pg::memory_policy().numa_bind = vm.count("numa") != 0;
+    // merge subcommand: primegen merge <files>
+    if (vm.positional.size() >= 1 && vm.positional[0].as<std::string>() == "merge")
+    {
+        std::vector<std::string> files;
+        for (size_t i = 1; i < vm.positional.size(); ++i)
+            files.emplace_back(vm.positional[i].as<std::string>());
+        return merge(files);
+    }
+#ifdef __SIZEOF_INT128__
+    if (vm.count("isprime"))
+        return run_isprime(isprimestr);
+#endif
+    if (vm.count("queries"))
+        return run_queries(queriesstr);
+#ifdef PRIMEGEN_SERVER
+    if (vm.count("serve"))
+    {
+        const bigint_t maxrange = parse_bigint(maxrangestr);
+        if (maxrange >> 64)
+            throw std::runtime_error("--maxrange must be < 2^64");
+        return prime_server(cachemb << 20, uint64_t(maxrange)).serve(servestr);
+    }
+#endif
     // if two positional arguments are given then parse as: <lb> <ub>
     if (vm.positional.size() >= 2)
     {
-        ub = vm.positional[1].as<size_t>();
-        lb = vm.positional[0].as<size_t>();
+        ubstr = vm.positional[1].as<std::string>();
+        lbstr = vm.positional[0].as<std::string>();
     }
     // if only one positional argument is given then parse as: <ub>
     else if (vm.positional.size() == 1)
     {
-        ub = vm.positional[0].as<size_t>();
+        ubstr = vm.positional[0].as<std::string>();
     }
+    bigint_t biglb = parse_bigint(lbstr), bigub = parse_bigint(ubstr);
+    size_t shard = 0, shards = 1;
+    if (vm.count("shard") && !parse_shard(shardstr, shard, shards))
+        throw std::runtime_error("Invalid shard (expected i/N with 0 <= i < N): " + shardstr);
 
     // print help
-    if (vm.count("help") || ub < lb)
+    if (vm.count("help") || bigub < biglb)
     {
         po::print_options_description({opts});
         return 0;
     }
 
+#ifdef __SIZEOF_INT128__
+    if (vm.count("build-table"))
+    {
+        if (bigub > ~uint64_t(0))
+            throw std::runtime_error("--build-table is only supported for end < 2^64");
+        pg::prime_table::build(buildtablestr, uint64_t(bigub), unsigned(log2interval), unsigned(threads));
+        return 0;
+    }
+    if (vm.count("table"))
+    {
+        if (!vm.count("sum") || bigub > ~uint64_t(0))
+            throw std::runtime_error("--table is only supported with '-s' for end < 2^64");
+        pg::prime_table table(tablestr);
+        std::cout << "count=" << table.count(uint64_t(biglb), uint64_t(bigub)) << " sum=" << to_string(table.sum(uint64_t(biglb), uint64_t(bigub))) << std::endl;
+        return 0;
+    }
+#endif
+
+#ifdef PRIMEGEN_PWRITE
+    if (vm.count("output"))
+    {
+        if (vm.count("sum") || vm.count("shard") || vm.count("mod") || vm.count("twins") || vm.count("tuplet") || vm.count("gaps"))
+            throw std::runtime_error("--output is only supported for printing all primes in a range");
+        if (bigub > ~uint64_t(0))
+            return run_output<bigint_t>(outputstr, biglb, bigub, threads);
+        return run_output<uint64_t>(outputstr, uint64_t(biglb), uint64_t(bigub), threads);
+    }
+#endif
+
+#ifdef __SIZEOF_INT128__
+    if (vm.count("random"))
+    {
+        if (bigub > ~uint64_t(0))
+            throw std::runtime_error("--random is only supported for end < 2^64");
+        const bigint_t randomcount = parse_bigint(randomstr);
+        if (randomcount > ~size_t(0))
+            throw std::runtime_error("--random count too large: " + randomstr);
+        pg::random_prime_sampler sampler(uint64_t(biglb), uint64_t(bigub), seed);
+        sampler.sample(size_t(randomcount), [](uint64_t p) { printf("%llu\n", (unsigned long long)p); });
+        return 0;
+    }
+#endif
+
+    std::vector<size_t> offsets;
+    if (vm.count("twins"))
+        offsets = {0, 2};
+    if (vm.count("tuplet"))
+        offsets = parse_offsets(tupletstr);
+    const bool wordstats = !offsets.empty() || vm.count("gaps");
+    if (wordstats && vm.count("shard"))
+        throw std::runtime_error("--shard is not supported with --twins, --tuplet and --gaps");
+    const pg::engine_t forcedengine = vm.count("engine") ? pg::parse_engine(enginestr) : pg::engine_count;
+    if (vm.count("engine") && forcedengine == pg::engine_count)
+        throw std::runtime_error("Unknown engine: " + enginestr);
+    // ranges beyond 2^64, --shard and --mod have a single engine
+    if (vm.count("engine") && (bigub > ~size_t(0) || vm.count("shard") || vm.count("mod")) && forcedengine != pg::engine_segmented)
+        throw std::runtime_error("--engine " + enginestr + " is not supported for ranges beyond 2^64, --shard and --mod");
+
     // execute
-    pg::prime_sieve ps;
-    if (!vm.count("sum"))
+    if (bigub > ~size_t(0))
     {
-        ps.genprimes(lb, ub, pg::printprime());
-    } else {
-        size_t psum = 0, pcnt = 0;
-        bool overflow = false;
-        ps.genprimes(lb, ub, [&](size_t p){ ++pcnt; psum += p; if (psum < p) overflow = true; });
-        if (overflow)
+        if (wordstats)
+        {
+            pg::basic_range_sieve<bigint_t> rs;
+            return run_wordstats<bigint_t>(rs, biglb, bigub, offsets, vm.count("gaps"), vm.count("sum"));
+        }
+        if (vm.count("shard"))
+            throw std::runtime_error("--shard is only supported for ranges below 2^64");
+        if (vm.count("explain"))
+            std::cerr << pg::estimate_engines(biglb, bigub, 1u << pg::engine_segmented).explain() << std::endl;
+        return run_bigrange<bigint_t>(biglb, bigub, vm.count("sum"), vm.count("pipeline"));
+    }
+    size_t lb = size_t(biglb), ub = size_t(bigub);
+    if (vm.count("mod"))
+    {
+        if (wordstats || vm.count("shard"))
+            throw std::runtime_error("--mod is not supported with --shard, --twins, --tuplet and --gaps");
+        const bigint_t bigmodulus = parse_bigint(modstr);
+        if (bigmodulus > ~size_t(0))
+            throw std::runtime_error("--mod must be < 2^64");
+        const size_t modulus = size_t(bigmodulus);
+        std::vector<uint64_t> residues;
+        if (vm.count("residue"))
+        {
+            for (auto a : parse_offsets(residuestr))
+                residues.emplace_back(a);
+        }
+        else
+        {
+            if (modulus > (1<<24))
+                throw std::runtime_error("--residue is required for modulus > 2^24");
+            for (size_t a = 0; a < modulus; ++a)
+                if (pg::gcd(a, modulus) == 1)
+                    residues.emplace_back(a);
+        }
+        pg::residue_sieve rs(modulus, residues);
+        if (!vm.count("sum"))
+        {
+            rs.genprimes(lb, ub, pg::printprime());
+        } else {
+            std::vector<size_t> counts = rs.count(lb, ub);
+            size_t pcnt = 0;
+            for (size_t c = 0; c < counts.size(); ++c)
+            {
+                std::cout << "residue=" << rs.residues()[c] << " count=" << counts[c] << std::endl;
+                pcnt += counts[c];
+            }
+            std::cout << "count=" << pcnt << std::endl;
+        }
+        return 0;
+    }
+    if (vm.count("shard"))
+    {
+        size_t shardlb, shardub;
+        shard_range(lb, ub, shard, shards, shardlb, shardub);
+        pg::range_sieve rs;
+        if (!vm.count("sum"))
+        {
+            genprimes(rs, shardlb, shardub, pg::printprime(), vm.count("pipeline"));
+        } else {
+            size_t psum = 0, pcnt = 0;
+            bool overflow = false;
+            genprimes(rs, shardlb, shardub, [&](size_t p){ ++pcnt; psum += p; if (psum < p) overflow = true; }, vm.count("pipeline"));
+            std::cout << "shard=" << shard << "/" << shards << " begin=" << shardlb << " end=" << shardub
+                << " count=" << pcnt << " sum=" << psum << " overflow=" << (overflow?1:0) << std::endl;
+        }
+        return 0;
+    }
+    // choose the engine by the shape of the range, see --explain
+    unsigned engines = (1u << pg::engine_dense) | (1u << pg::engine_segmented);
+    if (!wordstats)
+        engines |= 1u << pg::engine_primality;
+    if (!wordstats && vm.count("sum"))
+        engines |= 1u << pg::engine_analytic;
+    pg::engine_estimate_t estimate;
+    if (vm.count("engine"))
+    {
+        // the forced engine only has to be able to handle the range
+        if ((engines & (1u << forcedengine)) == 0)
+            throw std::runtime_error("--engine " + enginestr + " is not supported for this output");
+        estimate = pg::estimate_engines(lb, ub, 1u << forcedengine, pg::engine_cost_model_t::unlimited());
+        if (estimate.engine != forcedengine || estimate.seconds[forcedengine] < 0)
+            throw std::runtime_error("--engine " + enginestr + " is not supported for this range");
+    } else
+        estimate = pg::estimate_engines(lb, ub, engines);
+    if (vm.count("explain"))
+        std::cerr << estimate.explain() << std::endl;
+    switch (estimate.engine)
+    {
+    case pg::engine_dense:
+    {
+        pg::prime_sieve ps;
+        if (wordstats)
+            return run_wordstats<size_t>(ps, lb, ub, offsets, vm.count("gaps"), vm.count("sum"));
+        return run_range(ps, lb, ub, vm.count("sum"), vm.count("pipeline"));
+    }
+#ifdef __SIZEOF_INT128__
+    case pg::engine_primality:
+    {
+        pg::primality_tester pt;
+        return run_range(pt, lb, ub, vm.count("sum"), vm.count("pipeline"));
+    }
+    case pg::engine_analytic:
+    {
+        const pg::prime_counter::result_t r = pg::prime_counter::count(lb, ub);
+        if (r.sum > ~size_t(0))
             std::cerr << "Warning: sum overflow in size_t" << std::endl;
-        std::cout << "count=" << pcnt << " sum=" << psum << std::endl;
+        std::cout << "count=" << r.count << " sum=" << size_t(r.sum) << std::endl;
+        return 0;
+    }
+#endif
+    default:
+    {
+        pg::range_sieve rs;
+        if (wordstats)
+            return run_wordstats<size_t>(rs, lb, ub, offsets, vm.count("gaps"), vm.count("sum"));
+        return run_range(rs, lb, ub, vm.count("sum"), vm.count("pipeline"));
+    }
     }
-
     return 0;
 }
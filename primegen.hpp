@@ -33,14 +33,36 @@
 #include <cstdio>
 #include <cstring>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <new>
+#include <random>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifdef __linux__
+#include <fstream>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __AVX512VBMI2__
+#include <immintrin.h>
+#endif
+
 namespace primegen
 {
 
-// we use __builtin_ctz functions that are present with gcc and clang
-// for MSVC these are missing and we define them using _BitScanForward instead
+// we use __builtin_ctz and __builtin_popcount functions that are present with gcc and clang
+// for MSVC these are missing and we define them using _BitScanForward and __popcnt64 instead
 #ifdef _MSC_VER
 #ifndef __clang__
 #include <intrin.h>
@@ -50,43 +72,270 @@ inline unsigned long __builtin_ctzll(unsigned long long x)
     _BitScanForward64(&index, x);
     return ret;
 }
+inline int __builtin_popcountll(unsigned long long x)
+{
+    return int(__popcnt64(x));
+}
+#endif
 #endif
+
+#ifdef __SIZEOF_INT128__
+// 128-bit unsigned integer type for ranges beyond 2^64
+typedef unsigned __int128 uint128_t;
 #endif
 
 template<typename Int>
 Int ceil_sqrt(Int x)
 {
     // r := smallest i such that i*i >= x
-    Int r = std::llround(std::sqrt(double(x)) - 1.0);
-    while (r*r < x)
+    // uses r < ceil(x/r) <=> r*r < x to avoid overflow of r*r
+    if (x <= 1)
+        return x;
+    Int r = Int(std::llround(std::sqrt(double(x)) - 1.0));
+    if (r == 0)
+        r = 1;
+    while (r < x / r + (x % r != 0 ? 1 : 0))
         ++r;
-    if ((r-1)*(r-1) >= x)
+    if (r > 1 && r-1 >= x / (r-1) + (x % (r-1) != 0 ? 1 : 0))
         throw std::runtime_error("ceil_sqrt error");
     return r;
 }
 
+template<typename Int>
+Int gcd(Int a, Int b)
+{
+    while (b != 0)
+    {
+        Int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// memory policy for large sieve buffers and worker threads
+// - pages_huge2m: buffers >= 2MiB are mmapped at 2MiB alignment and advised to use transparent huge pages
+// - pages_huge1g: buffers >= 2MiB are mmapped on 1GiB hugetlb pages if available, otherwise as for pages_huge2m
+// - numa_bind: worker threads pin themselves to the CPUs of NUMA node (thread index mod number of nodes) before
+//   allocating their buffers, so that first-touch places their memory on the local node (no memory policy is set)
+// huge pages and NUMA binding are best effort: only supported on Linux, failures and other platforms are ignored
+enum page_policy_t { pages_default, pages_huge2m, pages_huge1g };
+struct memory_policy_t
+{
+    page_policy_t pages;
+    bool numa_bind;
+};
+inline memory_policy_t& memory_policy()
+{
+    static memory_policy_t policy = { pages_default, false };
+    return policy;
+}
+// parse page policy: "none", "2m" or "1g"
+inline page_policy_t parse_page_policy(const std::string& str)
+{
+    if (str == "none")
+        return pages_default;
+    if (str == "2m" || str == "2M")
+        return pages_huge2m;
+    if (str == "1g" || str == "1G")
+        return pages_huge1g;
+    throw std::runtime_error("Invalid huge page policy (expected none, 2m or 1g): " + str);
+}
+
+namespace detail
+{
+    static const size_t hugepage_size = size_t(1) << 21;
+    static const size_t gigapage_size = size_t(1) << 30;
+
+    // sizes of mmapped buffers, which are freed with munmap
+    inline std::mutex& mapped_mutex() { static std::mutex m; return m; }
+    inline std::unordered_map<void*, size_t>& mapped_buffers() { static std::unordered_map<void*, size_t> m; return m; }
+
+    inline void* allocate_buffer(size_t bytes)
+    {
+#ifdef __linux__
+        const page_policy_t pages = memory_policy().pages;
+        if (pages != pages_default && bytes >= hugepage_size)
+        {
+            void* p = MAP_FAILED;
+            size_t len = 0;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+            if (pages == pages_huge1g)
+            {
+                len = (bytes + gigapage_size - 1) & ~(gigapage_size - 1);
+                p = mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|(30 << MAP_HUGE_SHIFT), -1, 0);
+            }
+#endif
+            if (p == MAP_FAILED)
+            {
+                // map with extra room to align to 2MiB and unmap the unaligned head and tail
+                len = (bytes + hugepage_size - 1) & ~(hugepage_size - 1);
+                char* q = static_cast<char*>(mmap(nullptr, len + hugepage_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+                if (q == MAP_FAILED)
+                    throw std::bad_alloc();
+                char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(q) + hugepage_size - 1) & ~uintptr_t(hugepage_size - 1));
+                if (aligned != q)
+                    munmap(q, size_t(aligned - q));
+                if (aligned + len != q + len + hugepage_size)
+                    munmap(aligned + len, size_t(q + len + hugepage_size - (aligned + len)));
+#ifdef MADV_HUGEPAGE
+                madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+                p = aligned;
+            }
+            std::lock_guard<std::mutex> lock(mapped_mutex());
+            mapped_buffers()[p] = len;
+            return p;
+        }
+#endif
+        return ::operator new(bytes);
+    }
+
+    inline void free_buffer(void* p)
+    {
+#ifdef __linux__
+        {
+            std::lock_guard<std::mutex> lock(mapped_mutex());
+            auto it = mapped_buffers().find(p);
+            if (it != mapped_buffers().end())
+            {
+                munmap(p, it->second);
+                mapped_buffers().erase(it);
+                return;
+            }
+        }
+#endif
+        ::operator delete(p);
+    }
+} // namespace detail
+
+// allocator for sieve buffers following memory_policy()
+template<typename T>
+struct sieve_allocator
+{
+    typedef T value_type;
+    sieve_allocator() {}
+    template<typename U> sieve_allocator(const sieve_allocator<U>&) {}
+    T* allocate(size_t n) { return static_cast<T*>(detail::allocate_buffer(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { detail::free_buffer(p); }
+};
+template<typename T, typename U>
+bool operator==(const sieve_allocator<T>&, const sieve_allocator<U>&) { return true; }
+template<typename T, typename U>
+bool operator!=(const sieve_allocator<T>&, const sieve_allocator<U>&) { return false; }
+
+// number of NUMA nodes (1 if unknown)
+inline unsigned numa_nodes()
+{
+    unsigned nodes = 0;
+#ifdef __linux__
+    while (access(("/sys/devices/system/node/node" + std::to_string(nodes)).c_str(), F_OK) == 0)
+        ++nodes;
+#endif
+    return nodes == 0 ? 1 : nodes;
+}
+
+// pin the calling worker thread to the CPUs of NUMA node (worker mod numa_nodes()) if memory_policy().numa_bind is set
+// no-op if the node's cpulist cannot be read or on other platforms than Linux
+inline void numa_bind_worker(unsigned worker)
+{
+#ifdef __linux__
+    if (!memory_policy().numa_bind)
+        return;
+    const unsigned node = worker % numa_nodes();
+    // parse cpulist like "0-3,8-11"
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string cpulist;
+    if (!std::getline(ifs, cpulist))
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    size_t pos = 0;
+    while (pos < cpulist.size())
+    {
+        size_t end = cpulist.find(',', pos);
+        if (end == std::string::npos)
+            end = cpulist.size();
+        const std::string range = cpulist.substr(pos, end - pos);
+        const size_t dash = range.find('-');
+        const unsigned first = unsigned(std::stoul(range.substr(0, dash)));
+        const unsigned last = (dash == std::string::npos) ? first : unsigned(std::stoul(range.substr(dash + 1)));
+        for (unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &cpus);
+        pos = end + 1;
+    }
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+#else
+    (void)worker;
+#endif
+}
+
+template<typename Int> class basic_range_sieve;
+class primality_tester;
+
 class prime_sieve
 {
+    template<typename Int> friend class basic_range_sieve;
+    friend class primality_tester;
+
 public:
     typedef uint64_t word_t;
     static const size_t wordbits = sizeof(word_t)*8;
     static const size_t wordnumbers = 2*wordbits;
     // use tmp buffer of 256KiB for small primes
     static const size_t tmpbufsize = (1<<18) * 8 / wordbits;
+    // all primes < presieveub are presieved by the segmented sieves
+    static const size_t presieveub = 127;
+    // the dense sieve needs ub/16 bytes of memory, larger bounds would also overflow the sieve size computations
+    static const size_t maxub = size_t(1) << 48;
     
 private:
     static inline unsigned _word_ctz(uint64_t x) { return __builtin_ctzll(x); }
 
+public:
+    // write the positions of the set bits of x in increasing order to pos and return their number
+    // pos must have room for wordbits+8 entries: with AVX-512 VBMI2 all 64 bytes are written by one compress,
+    // otherwise the positions are found with ctz, which is the fastest at the density of primes in sieve words
+    static inline size_t word_bits(word_t x, uint8_t* pos)
+    {
+#ifdef __AVX512VBMI2__
+        const __m512i iota = _mm512_set_epi8(
+            63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48,
+            47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32,
+            31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        _mm512_storeu_si512(pos, _mm512_maskz_compress_epi8(x, iota));
+        return size_t(__builtin_popcountll(x));
+#else
+        size_t c = 0;
+        for (; x != 0; x &= x - 1)
+            pos[c++] = uint8_t(_word_ctz(x));
+        return c;
+#endif
+    }
+
+private:
     // MUST be the first k primes in order, for some chosen k
-    const size_t _prefilterprimes[7] = { 2, 3, 5, 7, 11, 13, 17 };
+    const size_t _prefilterprimes[6] = { 2, 3, 5, 7, 11, 13 };
+    // the segmented sieves also presieve all next primes < presieveub with one smaller pattern per group
+    // of primes, with a period of the product of the group's primes in words (0 is no prime)
+    const size_t _presievegroups[11][3] = {
+        { 17, 19, 23 }, { 29, 31, 37 }, { 41, 43, 0 }, { 47, 53, 0 }, { 59, 61, 0 }, { 67, 71, 0 },
+        { 73, 79, 0 }, { 83, 89, 0 }, { 97, 101, 0 }, { 103, 107, 0 }, { 109, 113, 0 } };
     
-    std::vector<word_t> _prefilter;
-    std::vector<word_t> _sieve;
-    std::vector<word_t> _tmpbuf;
-    size_t _tmpbufend;
+    typedef std::vector<word_t, sieve_allocator<word_t> > buffer_t;
+    buffer_t _prefilter;
+    std::vector<buffer_t> _presieve;
+    buffer_t _sieve;
+    buffer_t _tmpbuf;
+    size_t _tmpbufend, _tmpbufstart;
+    // sieve state kept across calls: all composites <= _sievedub are crossed off in _sieve
+    // with the base primes 13 < p < ceil_sqrt(_sievedub)
+    size_t _sievedub;
+    std::vector<size_t> _baseprimes;
     
 
-    inline void _markbit(std::vector<word_t>& sieve, size_t n) const
+    inline void _markbit(buffer_t& sieve, size_t n) const
     {
         sieve[ n / wordnumbers ] |= word_t(1) << ((n%wordnumbers)/2);
     }
@@ -120,18 +369,37 @@ private:
         }
     }
     
+    void _make_presieve()
+    {
+        if (!_presieve.empty())
+            return;
+        _make_prefilter();
+        for (auto& group : _presievegroups)
+        {
+            size_t period = 1;
+            for (size_t p : group)
+                if (p != 0)
+                    period *= p;
+            buffer_t pattern(period, 0);
+            for (size_t p : group)
+                if (p != 0)
+                    for (size_t i = p; i < period*wordnumbers; i += 2*p)
+                        _markbit(pattern, i);
+            _presieve.emplace_back(std::move(pattern));
+        }
+    }
+
     void _markprime(size_t p, size_t ub)
     {
         size_t begin = ((ub/p)/wordnumbers)*wordnumbers + 1;
         size_t end = ((p/wordnumbers)*wordnumbers) + 1;
         for (size_t j = begin; ; j-=wordnumbers)
         {
-            word_t x = ~_sieve[j/wordnumbers];
-            while (x != 0)
+            uint8_t pos[wordbits+8];
+            const size_t c = word_bits(~_sieve[j/wordnumbers], pos);
+            for (size_t i = 0; i < c; ++i)
             {
-                size_t b = _word_ctz(x);
-                x ^= word_t(1)<<b;
-                size_t m = p * (j+b*2);
+                size_t m = p * (j+pos[i]*2);
                 if (m <= ub)
                     _markbit(_sieve, m);
             }
@@ -140,6 +408,20 @@ private:
         }
     }
 
+    // OR the pending _tmpbuf pattern into the sieve from word _tmpbufstart on
+    void _flushtmpbuf()
+    {
+        size_t phase = _tmpbufstart % _tmpbufend;
+        for (size_t w = _tmpbufstart; w < _sieve.size(); )
+        {
+            const size_t len = std::min(_sieve.size() - w, _tmpbufend - phase);
+            for (size_t i = 0; i < len; ++i)
+                _sieve[w+i] |= _tmpbuf[phase+i];
+            w += len;
+            phase = 0;
+        }
+    }
+
     inline void _markprimefast(size_t p, size_t ub)
     {
         if (_tmpbufend == 0)
@@ -155,15 +437,7 @@ private:
         //   3. OR buffer into sieve and repeat buffer until end of sieve is reached
         if (_tmpbufend * p > _tmpbuf.size())
         {
-            // process _tmpbuf
-            for (auto it = _sieve.begin(); it < _sieve.end(); it += _tmpbufend)
-            {
-                auto itend = it + _tmpbufend; 
-                if (itend > _sieve.end())
-                    itend = _sieve.end();
-                for (auto it1 = it, it2 = _tmpbuf.begin(); it1 != itend; ++it1,++it2)
-                    *it1 |= *it2;
-            }
+            _flushtmpbuf();
             if (p < 192)
             {
                 // reset _tmpbuf
@@ -188,36 +462,154 @@ private:
             _markbit(_tmpbuf, i);
     }
             
+    // bits in the first word for the odd prefilter primes
+    word_t _prefilterprimebits() const
+    {
+        word_t bits = 0;
+        for (auto p : _prefilterprimes)
+            if (p != 2)
+                bits |= word_t(1) << (p/2);
+        return bits;
+    }
+
+    // bits in the first word for the odd prefilter and presieve primes
+    word_t _presieveprimebits() const
+    {
+        word_t bits = _prefilterprimebits();
+        for (auto& group : _presievegroups)
+            for (size_t p : group)
+                if (p != 0)
+                    bits |= word_t(1) << (p/2);
+        return bits;
+    }
+
+    // mask out bits of word for numbers n+2*b outside [lb,ub)
+    static inline word_t _maskword(size_t n, word_t x, size_t lb, size_t ub)
+    {
+        if (n < lb)
+            x &= (lb - n + 1) / 2 >= wordbits ? 0 : ~word_t(0) << ((lb - n + 1) / 2);
+        if (n + wordnumbers > ub)
+            x &= ub <= n ? 0 : ~word_t(0) >> (wordbits - (ub - n + 1) / 2);
+        return x;
+    }
+
+    // extend the sieve from _sievedub to ub > _sievedub:
+    // the new words are filled with the prefilter, crossed off with the stored base primes,
+    // then the new base primes < ceil_sqrt(ub) are found in the sieve and crossed off with _markprime
+    void _extend(size_t ub)
+    {
+        const size_t prefiltersize = _prefilter.size();
+        const size_t startword = _sievedub / wordnumbers, start = startword * wordnumbers;
+        _sieve.resize((ub + 2) / wordnumbers + 1);
+        for (size_t w = startword; w < _sieve.size(); )
+        {
+            const size_t phase = w % prefiltersize, len = std::min(_sieve.size() - w, prefiltersize - phase);
+            memcpy(&_sieve[w], &_prefilter[phase], len*wordbits/8);
+            w += len;
+        }
+        if (startword == 0)
+            _sieve[0] |= 1; // mark number 1 in sieve
+        // cross off odd multiples m >= max(p*p, start) of stored base primes:
+        // the small ones with the _tmpbuf pattern as in the first sieve, the others one by one
+        _tmpbuf.resize(tmpbufsize);
+        _tmpbuf[0] = 0;
+        _tmpbufend = 1;
+        _tmpbufstart = startword;
+        for (size_t p : _baseprimes)
+            if (p < 192)
+                _markprimefast(p, ub);
+        _flushtmpbuf();
+        _tmpbufend = 0;
+        for (size_t p : _baseprimes)
+        {
+            if (p < 192)
+            {
+                // the pattern also crossed off p itself
+                if (p >= start)
+                    _sieve[p / wordnumbers] &= ~(word_t(1) << ((p%wordnumbers)/2));
+                continue;
+            }
+            size_t m = std::max(p * p, (start + p - 1) / p * p);
+            if (m % 2 == 0)
+                m += p;
+            for (; m <= ub; m += 2*p)
+                _markbit(_sieve, m);
+        }
+        // new base primes p: all their multiples < p*p are already crossed off
+        const size_t oldmaxp = _baseprimes.empty() ? _prefilterprimes[5] + 1 : _baseprimes.back() + 2;
+        const size_t maxp = ceil_sqrt(ub);
+        for (size_t n = (oldmaxp / wordnumbers) * wordnumbers + 1; n < maxp; n += wordnumbers)
+        {
+            word_t x = ~_sieve[n/wordnumbers];
+            while (x != 0)
+            {
+                size_t b = _word_ctz(x);
+                x ^= word_t(1)<<b;
+                size_t p = n+2*b;
+                if (p < oldmaxp)
+                    continue;
+                if (p >= maxp)
+                    break;
+                _markprime(p, ub);
+                _baseprimes.push_back(p);
+            }
+        }
+        _sievedub = ub;
+    }
+
 public:
+    prime_sieve() : _tmpbufend(0), _tmpbufstart(0), _sievedub(0) {}
 
+    // release the sieve kept from earlier calls
+    void clear()
+    {
+        buffer_t().swap(_sieve);
+        buffer_t().swap(_tmpbuf);
+        std::vector<size_t>().swap(_baseprimes);
+        _sievedub = 0;
+    }
 
-    // generate all primes p in range [lb,ub] and for each call callback(p)
+    // generate all odd primes in range [lb,ub) as sieve words: for each consecutive word covering [lb,ub)
+    // call callback(n, x) where bit b of x is set iff n+2*b is an odd prime in [lb,ub)
+    // the sieve and base primes are kept for later calls: a call with ub below an earlier ub only reads the sieve,
+    // a larger ub extends the sieve to at least 1.5 times its size, so many consecutive calls cost the same as one big call
     template<typename F>
-    void genprimes(size_t lb, size_t ub, F&& callback)
+    void genwords(size_t lb, size_t ub, F&& callback)
     {
+        if (ub <= lb)
+            return;
+        if (ub > maxub)
+            throw std::runtime_error("prime_sieve: upper bound too large for a dense sieve, use range_sieve");
+
         // initialize prefilter
         _make_prefilter();
 
+        if (_sievedub != 0)
+        {
+            if (ub > _sievedub)
+                _extend(std::max(ub, _sievedub + _sievedub/2));
+            for (size_t n = (lb / wordnumbers) * wordnumbers + 1; n < ub; n += wordnumbers)
+            {
+                word_t x = ~_sieve[n/wordnumbers];
+                if (n == 1)
+                    x |= _prefilterprimebits();
+                callback(n, _maskword(n, x, lb, ub));
+            }
+            return;
+        }
+
         // initialize sieve with prefilter
         size_t ub_block_factor = (ub + 2 + (_prefilter.size()*wordnumbers) - 1) / (_prefilter.size()*wordnumbers);
         _sieve.resize( ub_block_factor * _prefilter.size() );
         for (size_t i = 0; i < ub_block_factor; ++i)
             memcpy(&_sieve[i * _prefilter.size()], &_prefilter[0], _prefilter.size()*wordbits/8);
         _sieve[0] |= 1; // mark number 1 in sieve
-        
-        // handle small primes of prefilter
-        for (auto p : _prefilterprimes)
-        {
-            if (p >= ub)
-                return;
-            if (p >= lb)
-                callback(p);
-        }
 
         // initialize tmp buffer        
         _tmpbuf.resize(tmpbufsize);
         _tmpbuf[0] = 0;
         _tmpbufend = 1;
+        _tmpbufstart = 0;
 
         size_t maxp = ceil_sqrt(ub);
 
@@ -225,62 +617,1663 @@ public:
         for (size_t n = 1; n < ub; n += wordnumbers)
         {
             word_t x = ~_sieve[n/wordnumbers];
-            while (x != 0)
+            if (n < maxp || _tmpbufend != 0)
             {
-                size_t b = _word_ctz(x);
-                x ^= word_t(1)<<b;
-                size_t p = n+2*b;
-                if (p >= ub)
-                    return;
-                if (p >= lb)
-                    callback(p);
-                if (p < maxp)
-                    _markprimefast(p, ub);
+                // mark all multiples of primes < maxp in this word
+                word_t y = x;
+                x = 0;
+                while (y != 0)
+                {
+                    size_t b = _word_ctz(y);
+                    y ^= word_t(1)<<b;
+                    x |= word_t(1)<<b;
+                    size_t p = n+2*b;
+                    if (p < maxp)
+                    {
+                        _markprimefast(p, ub);
+                        _baseprimes.push_back(p);
+                    }
+                    else if (_tmpbufend != 0)
+                    {
+                        // no more primes to mark: the last small primes may still be pending in _tmpbuf
+                        _flushtmpbuf();
+                        _tmpbufend = 0;
+                        y &= ~_sieve[n/wordnumbers];
+                    }
+                }
             }
+            if (n == 1)
+                x |= _prefilterprimebits();
+            if (n + wordnumbers > lb)
+                callback(n, _maskword(n, x, lb, ub));
+        }
+        if (_tmpbufend != 0)
+        {
+            _flushtmpbuf();
+            _tmpbufend = 0;
         }
+        // the _tmpbuf pattern also crossed off the small base primes themselves
+        for (size_t p : _baseprimes)
+        {
+            if (p >= 192)
+                break;
+            _sieve[p / wordnumbers] &= ~(word_t(1) << ((p%wordnumbers)/2));
+        }
+        _sievedub = ub;
+    }
+
+    // generate all primes p in range [lb,ub) and for each call callback(p)
+    template<typename F>
+    void genprimes(size_t lb, size_t ub, F&& callback)
+    {
+        // 2 is not in the sieve
+        if (lb <= 2 && 2 < ub)
+            callback(size_t(2));
+        genwords(lb, ub, [&callback](size_t n, word_t x)
+            {
+                uint8_t pos[wordbits+8];
+                const size_t c = word_bits(x, pos);
+                for (size_t i = 0; i < c; ++i)
+                    callback(n+2*pos[i]);
+            });
     }
 };
 
-// print prime p
-struct printprime
+// ring of buckets for segmented sieves, one bucket per upcoming segment, for sieving primes that hit a segment at most once
+// each entry is a prime (or any other id) with the 32-bit index of its next hit relative to the segment of its bucket
+// the ring must have more buckets than the largest step in segments, buckets keep their capacity when processed
+template<typename P>
+class basic_bucket_ring
 {
-    size_t _printlen;
-    size_t _printlast;
-    char _printstr[32];
-    
-    printprime() : _printlast(~size_t(0)) {}
-    
-    void operator()(size_t p)
+public:
+    struct entry_t
     {
-        // first initialization (and upon any decrease to be generic)
-        if (p < _printlast)
+        P p;
+        uint32_t index;
+    };
+
+    // empty ring for steps of at most maxstep indices in segments of segmentsize indices
+    void reset(uint64_t maxstep, uint64_t segmentsize)
+    {
+        _segmentsize = segmentsize;
+        _buckets.assign(size_t(maxstep / segmentsize + 2), std::vector<entry_t>());
+    }
+
+    // add p with its next hit at index i relative to segment seg
+    inline void push(uint64_t seg, P p, uint64_t i)
+    {
+        _buckets[size_t((seg + i / _segmentsize) % _buckets.size())].push_back(entry_t{ p, uint32_t(i % _segmentsize) });
+    }
+
+    // call next = f(entry) for each entry in the bucket of segment seg and move it to its next hit at index next
+    // relative to segment seg, entries with next == drop are removed
+    static const uint64_t drop = ~uint64_t(0);
+    template<typename F>
+    void process(uint64_t seg, F&& f)
+    {
+        std::vector<entry_t>& bucket = _buckets[size_t(seg % _buckets.size())];
+        for (size_t j = 0; j < bucket.size(); ++j)
         {
-            for (size_t i = 0; i < 30; ++i)
-                _printstr[i] = '0';
-            _printstr[30] = 0;
-            _printlen = 1;
-            _printlast = 0;
+            const entry_t e = bucket[j];
+            const uint64_t next = f(e);
+            if (next != drop)
+                push(seg, e.p, next);
         }
-        // update status
-        size_t d = p - _printlast;
-        _printlast = p;
-        // update print string using d
-        size_t i = 29;
-        do
-        {
-            d += _printstr[i] - '0';
-            _printstr[i] = '0' + (d%10);
-            d /= 10;
-            --i;
-        } while (d != 0);
-        // increase print length if needed
-        if (i < 29 - _printlen)
-            _printlen = 29-i;
-        // print string
-        puts(_printstr + 30 - _printlen);
+        bucket.clear();
     }
+
+private:
+    uint64_t _segmentsize;
+    std::vector< std::vector<entry_t> > _buckets;
 };
 
+// segmented sieve of Eratosthenes for an arbitrary range [lb,ub) with lb, ub of type Int (uint64_t or uint128_t)
+// the range is sieved in segments of fixed size starting at the sieve word containing lb,
+// the last segment is only sieved up to ub so that small ranges are cheap
+// - all positions are relative to the first segment, so the range length ub-lb must be < 2^64
+// - small sieving primes are kept with their next multiple as index in the current segment and cross off
+//   only the multiples p*k with k coprime to 30 using a mod 30 wheel
+// - large sieving primes hit a segment at most once and are kept in a ring of buckets, one per upcoming segment,
+//   each entry is the prime with its 32-bit index in the segment of its bucket
+// - the sieving primes < sqrt(ub) are kept in memory as uint32_t for 64-bit ranges and uint64_t for 128-bit ranges
+template<typename Int>
+class basic_range_sieve
+{
+public:
+    typedef prime_sieve::word_t word_t;
+    static const size_t wordbits = prime_sieve::wordbits;
+    static const size_t wordnumbers = prime_sieve::wordnumbers;
+    // use segment of 256KiB
+    static const size_t segmentwords = (1<<18) * 8 / wordbits;
+    static const size_t segmentnumbers = segmentwords * wordnumbers;
+
+    typedef Int integer_t;
+    typedef typename std::conditional<(sizeof(Int) > 8), uint64_t, uint32_t>::type sieveprime_t;
+
+private:
+    static inline unsigned _word_ctz(uint64_t x) { return __builtin_ctzll(x); }
+
+    struct smallprime_t
+    {
+        sieveprime_t p;
+        uint32_t next : 29; // index of next multiple p*k relative to current segment
+        uint32_t wheel : 3; // position of k mod 30 in the wheel
+    };
+
+    prime_sieve _ps;
+    // generator for the sieving primes: dense sieve for 64-bit ranges, segmented sieve for 128-bit ranges
+    typename std::conditional<(sizeof(Int) > 8), basic_range_sieve<uint64_t>, prime_sieve>::type _basegen;
+    std::vector<sieveprime_t> _primes; // sieving primes > prefilter primes
+    uint64_t _primesub;                // _primes contains all such primes < _primesub
+    std::vector<smallprime_t> _smallprimes;
+    basic_bucket_ring<sieveprime_t> _buckets; // index of next odd multiple relative to segment of bucket
+    std::vector<word_t> _segment;
+
+    void _prepare_primes(uint64_t maxp)
+    {
+        if (!_primes.empty() && maxp <= _primesub)
+            return;
+        _primes.clear();
+        _primesub = maxp;
+        _basegen.genprimes(prime_sieve::presieveub, maxp, [this](uint64_t p){ _primes.emplace_back(sieveprime_t(p)); });
+    }
+
+    // fill first words of segment with prefilter pattern and OR the presieve patterns at the right phase
+    void _fill_segment(Int segbegin, size_t words)
+    {
+        const size_t prefiltersize = _ps._prefilter.size();
+        size_t phase = size_t((segbegin / wordnumbers) % prefiltersize);
+        for (size_t i = 0; i < words; )
+        {
+            size_t len = std::min(words - i, prefiltersize - phase);
+            memcpy(&_segment[i], &_ps._prefilter[phase], len*wordbits/8);
+            i += len;
+            phase = 0;
+        }
+        for (auto& pattern : _ps._presieve)
+        {
+            const size_t period = pattern.size();
+            phase = size_t((segbegin / wordnumbers) % period);
+            for (size_t i = 0; i < words; )
+            {
+                const size_t len = std::min(words - i, period - phase);
+                word_t* seg = &_segment[i];
+                const word_t* pat = &pattern[phase];
+                for (size_t j = 0; j < len; ++j)
+                    seg[j] |= pat[j];
+                i += len;
+                phase = 0;
+            }
+        }
+    }
+
+    inline void _markindex(size_t i)
+    {
+        _segment[i / wordnumbers] |= word_t(1) << ((i % wordnumbers) / 2);
+    }
+
+    // small primes only cross off multiples p*k with k coprime to 30, as multiples of 3 and 5 are already prefiltered
+    // the wheel steps through k = 1, 7, 11, 13, 17, 19, 23, 29 mod 30
+    static unsigned _wheelstep(unsigned w)
+    {
+        static const unsigned char step[8] = { 6, 4, 2, 4, 2, 4, 6, 2 };
+        return step[w];
+    }
+
+    // cross off small prime sp in the current segment up to seglen and move it to the next segment
+    inline void _marksmallprime(smallprime_t& sp, size_t seglen)
+    {
+        const size_t p = size_t(sp.p);
+        size_t i = sp.next;
+        unsigned w = sp.wheel;
+        // single steps up to the start of the wheel, then full turns of 8 multiples, then single steps
+        for (; w != 0 && i < seglen; w = (w + 1) % 8)
+        {
+            _markindex(i);
+            i += p * _wheelstep(w);
+        }
+        if (w == 0)
+        {
+            for (; i + 28 * p < seglen; i += 30 * p)
+            {
+                _markindex(i);
+                _markindex(i + 6 * p);
+                _markindex(i + 10 * p);
+                _markindex(i + 12 * p);
+                _markindex(i + 16 * p);
+                _markindex(i + 18 * p);
+                _markindex(i + 22 * p);
+                _markindex(i + 28 * p);
+            }
+            for (; i < seglen; w = (w + 1) % 8)
+            {
+                _markindex(i);
+                i += p * _wheelstep(w);
+            }
+        }
+        sp.next = uint32_t(i - segmentnumbers);
+        sp.wheel = w;
+    }
+
+    // start sieving with prime p in segment with relative position segrel
+    // at its first odd multiple >= max(p*p, segbegin0) if that is < segbegin0 + relub
+    inline void _addprime(uint64_t p, Int segbegin0, uint64_t segrel, uint64_t relub)
+    {
+        const Int pp = Int(p) * p;
+        uint64_t first;
+        if (pp >= segbegin0)
+            first = uint64_t(pp - segbegin0);
+        else
+        {
+            first = (p - uint64_t(segbegin0 % p)) % p;
+            if (first % 2 == 0) // segbegin0 is even: make multiple odd
+                first += p;
+        }
+        if (first >= relub)
+            return;
+        if (2*p < segmentnumbers)
+        {
+            // start the wheel at the first k >= (segbegin0 + first)/p coprime to 30
+            static const unsigned char wheeldelta[30] = { 1,0,5,4,3,2,1,0,3,2,1,0,1,0,3,2,1,0,1,0,3,2,1,0,5,4,3,2,1,0 };
+            static const unsigned char wheelpos[30] = { 0,0,1,1,1,1,1,1,2,2,2,2,3,3,4,4,4,4,5,5,6,6,6,6,7,7,7,7,7,7 };
+            const unsigned k = unsigned(pp >= segbegin0 ? p % 30 : uint64_t(((segbegin0 + first) / p) % 30));
+            first += uint64_t(wheeldelta[k]) * p;
+            if (first >= relub)
+                return;
+            _smallprimes.push_back(smallprime_t{ sieveprime_t(p), uint32_t(first - segrel), wheelpos[k] });
+        } else {
+            uint64_t rel = first - segrel;
+            _buckets.push(segrel / segmentnumbers, sieveprime_t(p), rel);
+        }
+    }
+
+public:
+    basic_range_sieve() : _primesub(0) {}
+
+    // keep the sieving primes for all later ranges with ub <= maxub in memory (only for 64-bit ranges)
+    void reserve(Int maxub)
+    {
+        if (sizeof(Int) <= 8)
+            _prepare_primes(uint64_t(ceil_sqrt(maxub)));
+    }
+
+    // generate all odd primes in range [lb,ub) as sieve words: for each consecutive word covering [lb,ub)
+    // call callback(n, x) where bit b of x is set iff n+2*b is an odd prime in [lb,ub)
+    template<typename F>
+    void genwords(Int lb, Int ub, F&& callback)
+    {
+        if (ub <= lb)
+            return;
+
+        // all positions are relative to the first segment
+        const Int segbegin0 = (lb / wordnumbers) * wordnumbers;
+        const uint64_t relub = uint64_t(ub - segbegin0), rellb = uint64_t(lb - segbegin0);
+        const uint64_t maxp = uint64_t(ceil_sqrt(ub));
+
+        // initialize prefilter and presieve, segment and buckets
+        _ps._make_presieve();
+        _segment.resize(segmentwords);
+        _smallprimes.clear();
+        _buckets.reset(2 * maxp, segmentnumbers);
+
+        // sieving primes p are activated once p*p < end of current segment
+        size_t activated = 0;
+        if (sizeof(Int) <= 8)
+        {
+            // 64-bit: keep all sieving primes in memory for later calls
+            _prepare_primes(maxp);
+        } else {
+            // 128-bit: there are too many sieving primes to keep in memory, instead the primes with p*p < end of
+            // the first segment are activated directly while they are generated and only the remaining ones are kept
+            const uint64_t firstmaxp = std::min<uint64_t>(maxp, uint64_t(ceil_sqrt(segbegin0 + segmentnumbers)));
+            _primes.clear();
+            _primesub = 0;
+            _basegen.genprimes(prime_sieve::presieveub, firstmaxp, [&](uint64_t p){ _addprime(p, segbegin0, 0, relub); });
+            _basegen.genprimes(firstmaxp, maxp, [this](uint64_t p){ _primes.emplace_back(sieveprime_t(p)); });
+        }
+
+        // start sieving!
+        for (uint64_t segrel = 0; segrel < relub; segrel += segmentnumbers)
+        {
+            const Int segbegin = segbegin0 + segrel;
+            // the last segment is only sieved up to relub
+            const size_t seglen = size_t(std::min<uint64_t>(segmentnumbers, relub - segrel));
+            _fill_segment(segbegin, (seglen + wordnumbers - 1) / wordnumbers);
+            if (segbegin == 0)
+                _segment[0] |= 1; // mark number 1 in sieve
+
+            // activate sieving primes at their first odd multiple >= max(p*p, segbegin0)
+            for (; activated < _primes.size(); ++activated)
+            {
+                const uint64_t p = _primes[activated];
+                const Int pp = Int(p) * p;
+                if (pp >= segbegin && pp - segbegin >= segmentnumbers)
+                    break;
+                _addprime(p, segbegin0, segrel, relub);
+            }
+
+            // cross off small primes
+            for (auto& sp : _smallprimes)
+                _marksmallprime(sp, seglen);
+
+            // cross off large primes in bucket of this segment and move them to the bucket of their next multiple
+            _buckets.process(segrel / segmentnumbers, [&](const typename basic_bucket_ring<sieveprime_t>::entry_t& bp)
+                {
+                    _markindex(bp.index);
+                    const uint64_t next = uint64_t(bp.index) + 2 * uint64_t(bp.p);
+                    return segrel + next >= relub ? basic_bucket_ring<sieveprime_t>::drop : next;
+                });
+
+            // output words
+            if (segbegin == 0)
+                _segment[0] &= ~_ps._presieveprimebits();
+            for (size_t w = 0; w < segmentwords; ++w)
+            {
+                const uint64_t n = segrel + w * wordnumbers + 1;
+                if (n >= relub)
+                    return;
+                if (n + wordnumbers > rellb)
+                    callback(segbegin0 + n, prime_sieve::_maskword(n, ~_segment[w], rellb, relub));
+            }
+        }
+    }
+
+    // generate all primes p in range [lb,ub) and for each call callback(p)
+    template<typename F>
+    void genprimes(Int lb, Int ub, F&& callback)
+    {
+        // 2 is not in the sieve
+        if (lb <= 2 && 2 < ub)
+            callback(Int(2));
+        genwords(lb, ub, [&callback](Int n, word_t x)
+            {
+                uint8_t pos[wordbits+8];
+                const size_t c = prime_sieve::word_bits(x, pos);
+                for (size_t i = 0; i < c; ++i)
+                    callback(n+2*pos[i]);
+            });
+    }
+};
+
+typedef basic_range_sieve<uint64_t> range_sieve;
+#ifdef __SIZEOF_INT128__
+typedef basic_range_sieve<uint128_t> range_sieve128;
+#endif
+
+#ifdef __SIZEOF_INT128__
+// LRU cache of sieved segments for repeated queries on the same neighbourhoods of 64-bit numbers
+// - segments are aligned ranges [k*segmentnumbers, (k+1)*segmentnumbers) sieved with range_sieve on a miss
+// - each segment is stored wheel-compressed: one byte per 30 numbers with one bit per residue coprime to 30
+// - each segment keeps its prime count and sum and prefix counts per block of bytes,
+//   so counts cost a lookup plus a popcount of at most one block and full segments are never touched
+// - segments are evicted in least recently used order once their total size exceeds the byte budget
+class segment_cache
+{
+public:
+    static const size_t segmentbytes = 1<<17;
+    static const uint64_t segmentnumbers = 30 * uint64_t(segmentbytes);
+    static const size_t blockbytes = 512;
+
+    segment_cache(size_t bytebudget = size_t(64) << 20)
+        : _bytebudget(bytebudget), _bytes(0), _hits(0), _misses(0)
+    {
+    }
+
+    // count primes in [lb,ub)
+    uint64_t count(uint64_t lb, uint64_t ub)
+    {
+        uint64_t c = _smallprimes(lb, ub, [](uint64_t){});
+        _foreach(lb, ub, [&c,this](const segment_t& seg, size_t a, size_t b)
+            {
+                c += (a == 0 && b == segmentnumbers) ? seg.count : _countbelow(seg, b) - _countbelow(seg, a);
+            });
+        return c;
+    }
+
+    // sum of primes in [lb,ub)
+    uint128_t sum(uint64_t lb, uint64_t ub)
+    {
+        uint128_t s = 0;
+        _smallprimes(lb, ub, [&s](uint64_t p){ s += p; });
+        _foreach(lb, ub, [&s](const segment_t& seg, size_t a, size_t b)
+            {
+                if (a == 0 && b == segmentnumbers)
+                    s += seg.sum;
+                else
+                    _genprimes(seg, a, b, [&s](uint64_t p){ s += p; });
+            });
+        return s;
+    }
+
+    // generate all primes p in range [lb,ub) and for each call callback(p)
+    template<typename F>
+    void genprimes(uint64_t lb, uint64_t ub, F&& callback)
+    {
+        _smallprimes(lb, ub, callback);
+        _foreach(lb, ub, [&callback](const segment_t& seg, size_t a, size_t b){ _genprimes(seg, a, b, callback); });
+    }
+
+    size_t bytes() const { return _bytes; }
+    size_t hits() const { return _hits; }
+    size_t misses() const { return _misses; }
+
+private:
+    struct segment_t
+    {
+        uint64_t index;
+        uint64_t count;
+        uint128_t sum;
+        std::vector<uint8_t> bits;
+        std::vector<uint32_t> prefix; // number of primes in bytes before each block
+    };
+
+    size_t _bytebudget, _bytes, _hits, _misses;
+    range_sieve _rs;
+    std::list<segment_t> _lru; // most recently used first
+    std::unordered_map<uint64_t, std::list<segment_t>::iterator> _index;
+
+    static const uint8_t* _residues()
+    {
+        static const uint8_t residues[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+        return residues;
+    }
+    // bit of residue r mod 30 or 0 if gcd(r,30) > 1
+    static uint8_t _residuebit(size_t r)
+    {
+        static const uint8_t bits[30] = { 0,1,0,0,0,0, 0,2,0,0,0,4, 0,8,0,0,0,16, 0,32,0,0,0,64, 0,0,0,0,0,128 };
+        return bits[r];
+    }
+    // mask of bits of residues < r
+    static uint8_t _belowmask(size_t r)
+    {
+        uint8_t mask = 0;
+        for (size_t i = 0; i < r; ++i)
+            mask |= _residuebit(i);
+        return mask;
+    }
+
+    // primes 2, 3, 5 are not in the wheel
+    template<typename F>
+    static uint64_t _smallprimes(uint64_t lb, uint64_t ub, F&& callback)
+    {
+        uint64_t c = 0;
+        for (uint64_t p : { 2, 3, 5 })
+            if (lb <= p && p < ub)
+            {
+                callback(p);
+                ++c;
+            }
+        return c;
+    }
+
+    // number of primes in segment at offsets < a
+    static uint64_t _countbelow(const segment_t& seg, size_t a)
+    {
+        const size_t byte = a / 30, block = byte / blockbytes;
+        if (block == seg.prefix.size())
+            return seg.count;
+        uint64_t c = seg.prefix[block];
+        size_t i = block * blockbytes;
+        for (; i + 8 <= byte; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, &seg.bits[i], 8);
+            c += uint64_t(__builtin_popcountll(w));
+        }
+        for (; i < byte; ++i)
+            c += uint64_t(__builtin_popcountll(seg.bits[i]));
+        return c + uint64_t(__builtin_popcountll(seg.bits[byte] & _belowmask(a % 30)));
+    }
+
+    // primes in segment at offsets [a,b)
+    template<typename F>
+    static void _genprimes(const segment_t& seg, size_t a, size_t b, F&& callback)
+    {
+        const uint64_t base = seg.index * segmentnumbers;
+        for (size_t byte = a / 30; byte * 30 < b; ++byte)
+        {
+            unsigned x = seg.bits[byte];
+            while (x != 0)
+            {
+                const unsigned i = unsigned(__builtin_ctz(x));
+                x ^= 1u << i;
+                const size_t off = byte * 30 + _residues()[i];
+                if (a <= off && off < b)
+                    callback(base + off);
+            }
+        }
+    }
+
+    // sieve segment k and store it
+    const segment_t& _sieve(uint64_t k)
+    {
+        segment_t seg;
+        seg.index = k;
+        seg.count = 0;
+        seg.sum = 0;
+        seg.bits.assign(segmentbytes, 0);
+        const uint64_t base = k * segmentnumbers;
+        // the last segment ends at 2^64-1
+        const uint64_t end = (k + 1 == ~uint64_t(0) / segmentnumbers + 1) ? ~uint64_t(0) : base + segmentnumbers;
+        _rs.genprimes(base, end, [&seg,base](uint64_t p)
+            {
+                const uint64_t off = p - base;
+                const uint8_t bit = _residuebit(size_t(off % 30));
+                if (bit == 0)
+                    return;
+                seg.bits[size_t(off / 30)] |= bit;
+                ++seg.count;
+                seg.sum += p;
+            });
+        seg.prefix.resize(segmentbytes / blockbytes);
+        uint32_t c = 0;
+        for (size_t i = 0; i < segmentbytes; ++i)
+        {
+            if (i % blockbytes == 0)
+                seg.prefix[i / blockbytes] = c;
+            c += uint32_t(__builtin_popcount(seg.bits[i]));
+        }
+        // insert as most recently used and evict least recently used segments
+        _lru.push_front(std::move(seg));
+        _index[k] = _lru.begin();
+        _bytes += _segmentsize();
+        while (_bytes > _bytebudget && _lru.size() > 1)
+        {
+            _index.erase(_lru.back().index);
+            _lru.pop_back();
+            _bytes -= _segmentsize();
+        }
+        return _lru.front();
+    }
+
+    static size_t _segmentsize()
+    {
+        return sizeof(segment_t) + segmentbytes + (segmentbytes / blockbytes) * sizeof(uint32_t);
+    }
+
+    const segment_t& _get(uint64_t k)
+    {
+        auto it = _index.find(k);
+        if (it == _index.end())
+        {
+            ++_misses;
+            return _sieve(k);
+        }
+        ++_hits;
+        _lru.splice(_lru.begin(), _lru, it->second);
+        return _lru.front();
+    }
+
+    // call f(segment, a, b) for the offsets [a,b) of each segment that intersects [lb,ub)
+    template<typename F>
+    void _foreach(uint64_t lb, uint64_t ub, F&& f)
+    {
+        if (ub <= lb)
+            return;
+        for (uint64_t k = lb / segmentnumbers; k <= (ub - 1) / segmentnumbers; ++k)
+        {
+            const uint64_t base = k * segmentnumbers;
+            const size_t a = size_t(std::max(lb, base) - base);
+            const size_t b = size_t(std::min<uint64_t>(ub - base, segmentnumbers));
+            f(_get(k), a, b);
+        }
+    }
+};
+#endif // __SIZEOF_INT128__
+
+// sieve of Eratosthenes restricted to residue classes: primes p in [lb,ub) with p = a mod m for given residues a
+// each residue class has its own segmented bitmap over j for the numbers n = a + m*j,
+// so the cost and memory are a fraction #residues/m of sieving all numbers
+// - a sieving prime p that does not divide m hits class a at j = -a/m mod p and every p-th j thereafter
+// - sieving primes are activated per class once their first hit >= p*p is in the current segment,
+//   primes p >= segmentbits hit a segment at most once and are kept in a ring of buckets per class
+// - a class with gcd(a,m) > 1 contains at most one prime, namely gcd(a,m) itself
+class residue_sieve
+{
+public:
+    typedef prime_sieve::word_t word_t;
+    static const size_t wordbits = prime_sieve::wordbits;
+    // use segment of 256KiB per residue class
+    static const size_t segmentwords = (1<<18) * 8 / wordbits;
+    static const size_t segmentbits = segmentwords * wordbits;
+
+    residue_sieve(uint64_t modulus, const std::vector<uint64_t>& residues)
+        : _modulus(modulus), _residues(residues)
+    {
+        if (_modulus == 0)
+            throw std::runtime_error("residue_sieve: modulus must be > 0");
+        std::sort(_residues.begin(), _residues.end());
+        _residues.erase(std::unique(_residues.begin(), _residues.end()), _residues.end());
+        if (_residues.empty() || _residues.back() >= _modulus)
+            throw std::runtime_error("residue_sieve: residues must be < modulus");
+    }
+
+    uint64_t modulus() const { return _modulus; }
+    const std::vector<uint64_t>& residues() const { return _residues; }
+
+    // generate all primes p in range [lb,ub) in the residue classes in increasing order and for each call callback(p)
+    template<typename F>
+    void genprimes(uint64_t lb, uint64_t ub, F&& callback)
+    {
+        // the primes of classes with gcd(a,m) > 1 are merged into the output in order
+        std::vector<uint64_t> singles;
+        size_t nextsingle = 0;
+        for (size_t c = 0; c < _residues.size(); ++c)
+        {
+            const uint64_t g = _singleprime(c);
+            if (g != 0 && lb <= g && g < ub)
+                singles.push_back(g);
+        }
+        std::sort(singles.begin(), singles.end());
+        _sieve(lb, ub, [&](uint64_t j0, uint64_t wordend)
+            {
+                const size_t classes = _residues.size();
+                for (size_t w = 0; w < wordend; ++w)
+                {
+                    word_t y = 0;
+                    for (size_t c = 0; c < classes; ++c)
+                        y |= ~_segments[c][w];
+                    // n = a + m*j is increasing in (j,a)
+                    while (y != 0)
+                    {
+                        size_t b = __builtin_ctzll(y);
+                        y ^= word_t(1)<<b;
+                        const uint64_t j = j0 + w*wordbits + b;
+                        for (size_t c = 0; c < classes; ++c)
+                            if (0 == (_segments[c][w] & (word_t(1)<<b)))
+                            {
+                                const uint64_t p = _residues[c] + _modulus * j;
+                                for (; nextsingle < singles.size() && singles[nextsingle] < p; ++nextsingle)
+                                    callback(singles[nextsingle]);
+                                callback(p);
+                            }
+                    }
+                }
+            });
+        for (; nextsingle < singles.size(); ++nextsingle)
+            callback(singles[nextsingle]);
+    }
+
+    // count the primes in range [lb,ub) for each residue class
+    std::vector<size_t> count(uint64_t lb, uint64_t ub)
+    {
+        std::vector<size_t> counts(_residues.size(), 0);
+        _sieve(lb, ub, [this,&counts](uint64_t, uint64_t wordend)
+            {
+                for (size_t c = 0; c < _residues.size(); ++c)
+                    for (size_t w = 0; w < wordend; ++w)
+                        counts[c] += size_t(__builtin_popcountll(~_segments[c][w]));
+            }, [&counts](size_t c, uint64_t){ ++counts[c]; });
+        return counts;
+    }
+
+private:
+    struct classprime_t
+    {
+        uint32_t p;
+        uint64_t next; // next j in this class with p | a + m*j
+    };
+
+    uint64_t _modulus;
+    std::vector<uint64_t> _residues;
+    std::vector< std::vector<word_t> > _segments;
+    range_sieve _basegen;
+    std::vector<uint32_t> _primes, _inverses; // sieving primes p not dividing m and 1/m mod p
+    // per class: sieving primes < segmentbits with their next j, and the larger ones in a ring of buckets
+    std::vector< std::vector<classprime_t> > _classprimes;
+    std::vector< basic_bucket_ring<uint32_t> > _classbuckets;
+
+    // sieving primes are < 2^32, so a*b does not overflow for a, b < p
+    static uint64_t _mulmod(uint64_t a, uint64_t b, uint64_t p)
+    {
+        return a * b % p;
+    }
+    static uint64_t _invmod(uint64_t a, uint64_t p)
+    {
+        // a^(p-2) mod p
+        uint64_t r = 1;
+        for (uint64_t e = p - 2; e != 0; e >>= 1, a = _mulmod(a, a, p))
+            if (e & 1)
+                r = _mulmod(r, a, p);
+        return r;
+    }
+    static bool _isprime(uint64_t n)
+    {
+        if (n < 2)
+            return false;
+        for (uint64_t d = 2; d <= n / d; ++d)
+            if (n % d == 0)
+                return false;
+        return true;
+    }
+
+    // the only prime gcd(a,m) of class a if gcd(a,m) > 1, otherwise 0
+    uint64_t _singleprime(size_t c) const
+    {
+        const uint64_t g = gcd(_residues[c], _modulus);
+        if (g == 1 || g % _modulus != _residues[c] || !_isprime(g))
+            return 0;
+        return g;
+    }
+
+    // mark bits [from,to) of segment
+    static void _markrange(std::vector<word_t>& seg, uint64_t from, uint64_t to)
+    {
+        for (; from < to && from % wordbits != 0; ++from)
+            seg[from/wordbits] |= word_t(1) << (from%wordbits);
+        for (; from + wordbits <= to; from += wordbits)
+            seg[from/wordbits] = ~word_t(0);
+        for (; from < to; ++from)
+            seg[from/wordbits] |= word_t(1) << (from%wordbits);
+    }
+
+    // smallest j with a + m*j >= x
+    uint64_t _firstj(uint64_t a, uint64_t x) const
+    {
+        return x <= a ? 0 : (x - a - 1) / _modulus + 1;
+    }
+
+    // sieve all residue classes segment by segment:
+    // call segmentcallback(j0, wordend) for each segment, where bit j-j0 of _segments[c] is unset iff a_c + m*j is prime
+    // call singlecallback(c, p) for the prime p in classes with gcd(a_c,m) > 1
+    template<typename F, typename G>
+    void _sieve(uint64_t lb, uint64_t ub, F&& segmentcallback, G&& singlecallback)
+    {
+        if (ub <= lb)
+            return;
+        const size_t classes = _residues.size();
+        std::vector<bool> coprime(classes);
+        for (size_t c = 0; c < classes; ++c)
+        {
+            coprime[c] = (gcd(_residues[c], _modulus) == 1);
+            const uint64_t g = _singleprime(c);
+            if (g != 0 && lb <= g && g < ub)
+                singlecallback(c, g);
+        }
+
+        // j range over all classes, classes with n outside [lb,ub) are masked per class
+        const uint64_t jlb = _firstj(_residues.back(), lb), jub = _firstj(_residues.front(), ub);
+        const uint64_t maxp = uint64_t(ceil_sqrt(ub));
+
+        // sieving primes p < sqrt(ub) not dividing m, each class activates p once a + m*j >= p*p is in the current segment
+        // small primes cross off every segment, larger primes p >= segmentbits hit a segment at most once and are bucketed
+        _primes.clear();
+        _inverses.clear();
+        _basegen.genprimes(0, maxp, [this](uint64_t p)
+            {
+                if (_modulus % p == 0)
+                    return;
+                _primes.push_back(uint32_t(p));
+                _inverses.push_back(uint32_t(_invmod(_modulus % p, p)));
+            });
+        _classprimes.assign(classes, std::vector<classprime_t>());
+        _classbuckets.assign(classes, basic_bucket_ring<uint32_t>());
+        for (auto& buckets : _classbuckets)
+            buckets.reset(maxp, segmentbits);
+        std::vector<size_t> activated(classes, 0);
+
+        // start sieving!
+        _segments.assign(classes, std::vector<word_t>(segmentwords));
+        for (uint64_t sj = jlb; sj < jub; sj += segmentbits)
+        {
+            const uint64_t sjend = std::min<uint64_t>(sj + segmentbits, jub), segindex = (sj - jlb) / segmentbits;
+            for (size_t c = 0; c < classes; ++c)
+            {
+                std::vector<word_t>& seg = _segments[c];
+                if (!coprime[c])
+                {
+                    std::fill(seg.begin(), seg.end(), ~word_t(0));
+                    continue;
+                }
+                std::fill(seg.begin(), seg.end(), word_t(0));
+                // mark j outside [lb,ub) for this class and beyond the end of the segment
+                const uint64_t a = _residues[c];
+                _markrange(seg, 0, std::min(std::max(_firstj(a, lb), sj), sj + segmentbits) - sj);
+                _markrange(seg, std::min(std::max(_firstj(a, ub), sj), sj + segmentbits) - sj, segmentbits);
+                // numbers 0 and 1 are not prime
+                for (uint64_t n = 0; n < 2; ++n)
+                    if (n >= a && (n - a) % _modulus == 0 && (n - a) / _modulus >= sj && (n - a) / _modulus < sjend)
+                    {
+                        const uint64_t j = (n - a) / _modulus - sj;
+                        seg[j/wordbits] |= word_t(1) << (j%wordbits);
+                    }
+                // activate sieving primes at their first j >= max(jlb, j of p*p) with p | a + m*j
+                for (; activated[c] < _primes.size(); ++activated[c])
+                {
+                    const uint64_t p = _primes[activated[c]];
+                    const uint64_t jstart = std::max(jlb, _firstj(a, p*p));
+                    if (jstart >= sjend)
+                        break;
+                    const uint64_t j0 = _mulmod((p - a % p) % p, _inverses[activated[c]], p);
+                    const uint64_t j = jstart + (j0 + p - jstart % p) % p;
+                    if (j >= jub)
+                        continue;
+                    if (p < segmentbits)
+                        _classprimes[c].push_back(classprime_t{ uint32_t(p), j });
+                    else
+                        _classbuckets[c].push(segindex, uint32_t(p), j - sj);
+                }
+                // cross off sieving primes
+                for (auto& cp : _classprimes[c])
+                {
+                    uint64_t j = cp.next;
+                    for (; j < sjend; j += cp.p)
+                        seg[(j-sj)/wordbits] |= word_t(1) << ((j-sj)%wordbits);
+                    cp.next = j;
+                }
+                _classbuckets[c].process(segindex, [&](const basic_bucket_ring<uint32_t>::entry_t& bp)
+                    {
+                        seg[bp.index/wordbits] |= word_t(1) << (bp.index%wordbits);
+                        const uint64_t next = uint64_t(bp.index) + bp.p;
+                        return sj + next >= jub ? basic_bucket_ring<uint32_t>::drop : next;
+                    });
+            }
+            segmentcallback(sj, (sjend - sj + wordbits - 1) / wordbits);
+        }
+    }
+    template<typename F>
+    void _sieve(uint64_t lb, uint64_t ub, F&& segmentcallback)
+    {
+        _sieve(lb, ub, segmentcallback, [](size_t, uint64_t){});
+    }
+};
+
+#ifdef __SIZEOF_INT128__
+// batched deterministic primality test for arbitrary 64-bit numbers
+// - numbers are first screened with the prefilter and presieve patterns of prime_sieve (primes 2..113)
+// - remaining candidates get a strong probable prime test for the 7 bases of Jim Sinclair,
+//   which is deterministic for all n < 2^64, using Montgomery arithmetic
+// - candidates are processed in groups of lanes with interleaved independent Montgomery multiplications,
+//   all candidates are tested for base 2 first and only the survivors for the remaining bases
+class primality_tester
+{
+public:
+    typedef prime_sieve::word_t word_t;
+    static const size_t wordnumbers = prime_sieve::wordnumbers;
+    static const size_t lanes = 4;
+
+    primality_tester()
+    {
+        _ps._make_presieve();
+        _smallprimebits = _ps._presieveprimebits();
+    }
+
+    // test n[i] for i in [0,count) and set result[i] to 1 if n[i] is prime and 0 otherwise
+    void test(const uint64_t* n, size_t count, uint8_t* result)
+    {
+        _candidates.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            result[i] = _screen(n[i]);
+            if (result[i] == 2)
+                _candidates.push_back(i);
+        }
+        for (auto base : _bases)
+        {
+            // strong probable prime test for base on all remaining candidates, remove the composites
+            size_t survivors = 0;
+            for (size_t i = 0; i < _candidates.size(); i += lanes)
+            {
+                uint64_t x[lanes];
+                bool sprp[lanes];
+                const size_t l = std::min(lanes, _candidates.size() - i);
+                for (size_t j = 0; j < lanes; ++j)
+                    x[j] = n[_candidates[i + (j < l ? j : 0)]];
+                _sprp(x, base, sprp);
+                for (size_t j = 0; j < l; ++j)
+                    if (sprp[j])
+                        _candidates[survivors++] = _candidates[i+j];
+                    else
+                        result[_candidates[i+j]] = 0;
+            }
+            _candidates.resize(survivors);
+        }
+        for (auto i : _candidates)
+            result[i] = 1;
+    }
+
+    std::vector<uint8_t> test(const std::vector<uint64_t>& n)
+    {
+        std::vector<uint8_t> result(n.size());
+        if (!n.empty())
+            test(&n[0], n.size(), &result[0]);
+        return result;
+    }
+
+    // test a single number
+    bool is_prime(uint64_t n)
+    {
+        uint8_t r;
+        test(&n, 1, &r);
+        return r != 0;
+    }
+
+    // generate all primes p in range [lb,ub) and for each call callback(p) by testing the odd numbers in blocks
+    // this is the fastest way for narrow ranges at large numbers, where sieving needs all primes up to sqrt(ub)
+    template<typename F>
+    void genprimes(uint64_t lb, uint64_t ub, F&& callback)
+    {
+        static const size_t blocksize = 4096;
+        if (lb <= 2 && 2 < ub)
+            callback(uint64_t(2));
+        std::vector<uint64_t> n;
+        std::vector<uint8_t> result(blocksize);
+        // ub <= 2^64-1, so the largest odd candidate is at most 2^64-3 and a += 2 does not overflow
+        for (uint64_t a = std::max<uint64_t>(lb, 3) | 1; a < ub; )
+        {
+            n.clear();
+            for (; a < ub && n.size() < blocksize; a += 2)
+                n.push_back(a);
+            test(&n[0], n.size(), &result[0]);
+            for (size_t i = 0; i < n.size(); ++i)
+                if (result[i])
+                    callback(n[i]);
+        }
+    }
+
+private:
+    const uint64_t _bases[7] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+
+    prime_sieve _ps;
+    prime_sieve::word_t _smallprimebits;
+    std::vector<size_t> _candidates;
+
+    // 0 if n is composite, 1 if n is prime, 2 if n needs a probable prime test
+    uint8_t _screen(uint64_t n) const
+    {
+        if (n % 2 == 0)
+            return n == 2 ? 1 : 0;
+        // the odd primes < presieveub are exactly the presieve primes
+        if (n < prime_sieve::presieveub)
+            return uint8_t((_smallprimebits >> (n / 2)) & 1);
+        const uint64_t w = n / wordnumbers;
+        const unsigned b = unsigned(n % wordnumbers) / 2;
+        if ((_ps._prefilter[w % _ps._prefilter.size()] >> b) & 1)
+            return 0;
+        for (auto& pattern : _ps._presieve)
+            if ((pattern[w % pattern.size()] >> b) & 1)
+                return 0;
+        // no prime factor < presieveub and n < presieveub^2
+        if (n < prime_sieve::presieveub * prime_sieve::presieveub)
+            return 1;
+        return 2;
+    }
+
+    // Montgomery arithmetic modulo odd n with R = 2^64
+    struct montgomery_t
+    {
+        uint64_t n, ninv, one, minusone;
+
+        void init(uint64_t _n)
+        {
+            n = _n;
+            // n^-1 mod 2^64 by Newton iteration, each step doubles the number of correct bits
+            ninv = n;
+            for (int i = 0; i < 5; ++i)
+                ninv *= 2 - n * ninv;
+            one = (0 - n) % n;
+            minusone = n - one;
+        }
+        // a*b/R mod n
+        inline uint64_t mul(uint64_t a, uint64_t b) const
+        {
+            const uint128_t t = uint128_t(a) * b;
+            const uint64_t m = uint64_t(t) * ninv;
+            const uint64_t mnhi = uint64_t((uint128_t(m) * n) >> 64), thi = uint64_t(t >> 64);
+            return thi >= mnhi ? thi - mnhi : thi - mnhi + n;
+        }
+        // a*R mod n
+        inline uint64_t to(uint64_t a) const
+        {
+            return uint64_t((uint128_t(a % n) << 64) % n);
+        }
+    };
+
+    // strong probable prime test for base a on lanes odd numbers n[j] > a or with a mod n[j] != 0
+    void _sprp(const uint64_t* n, uint64_t a, bool* sprp) const
+    {
+        montgomery_t mg[lanes];
+        uint64_t d[lanes], x[lanes], am[lanes];
+        unsigned s[lanes], maxbits = 0, maxs = 0;
+        for (size_t j = 0; j < lanes; ++j)
+        {
+            mg[j].init(n[j]);
+            s[j] = __builtin_ctzll(n[j] - 1);
+            d[j] = (n[j] - 1) >> s[j];
+            am[j] = mg[j].to(a);
+            x[j] = mg[j].one;
+            maxbits = std::max(maxbits, unsigned(64 - __builtin_clzll(d[j])));
+            maxs = std::max(maxs, s[j]);
+        }
+        // x = a^d mod n by left-to-right binary exponentiation, interleaved over all lanes
+        for (unsigned b = maxbits; b-- > 0; )
+            for (size_t j = 0; j < lanes; ++j)
+            {
+                x[j] = mg[j].mul(x[j], x[j]);
+                const uint64_t y = mg[j].mul(x[j], am[j]);
+                x[j] = ((d[j] >> b) & 1) ? y : x[j];
+            }
+        // n is a strong probable prime iff a = 0 mod n or x = 1 or x^(2^r) = -1 mod n for some 0 <= r < s
+        for (size_t j = 0; j < lanes; ++j)
+            sprp[j] = (am[j] == 0 || x[j] == mg[j].one || x[j] == mg[j].minusone);
+        for (unsigned r = 1; r < maxs; ++r)
+            for (size_t j = 0; j < lanes; ++j)
+            {
+                x[j] = mg[j].mul(x[j], x[j]);
+                sprp[j] = sprp[j] || (r < s[j] && x[j] == mg[j].minusone);
+            }
+    }
+};
+
+// number and sum of primes <= x without enumerating them, in O(x^(3/4)) time and O(sqrt(x)) memory,
+// with the Lucy_Hedgehog variant of Legendre's method: for the O(sqrt(x)) distinct values v = x/i
+// let S(v,p) be the number (or sum) of 2 <= n <= v that are prime or have no prime factor <= p, then
+//   S(v,p) = S(v,p-1) - p^e * (S(v/p,p-1) - S(p-1,p-1))  for primes p with p*p <= v (e = 0 for counts, 1 for sums)
+// and S(v,sqrt(v)) is the number (or sum) of primes <= v
+class prime_counter
+{
+public:
+    struct result_t
+    {
+        uint64_t count;
+        uint128_t sum;
+    };
+
+    // memory in bytes needed for x
+    static uint64_t memory(uint64_t x)
+    {
+        return 2 * (_isqrt(x) + 1) * (sizeof(uint64_t) + sizeof(uint128_t));
+    }
+
+    static result_t count(uint64_t x)
+    {
+        if (x < 2)
+            return result_t{ 0, 0 };
+        const uint64_t r = _isqrt(x);
+        // lo[v] for v <= r and hi[i] for v = x/i with i <= r
+        std::vector<uint64_t> locount(r+1), hicount(r+1);
+        std::vector<uint128_t> losum(r+1), hisum(r+1);
+        for (uint64_t v = 1; v <= r; ++v)
+        {
+            locount[v] = v - 1;
+            losum[v] = _triangle(v) - 1;
+            hicount[v] = x/v - 1;
+            hisum[v] = _triangle(x/v) - 1;
+        }
+        for (uint64_t p = 2; p <= r; ++p)
+        {
+            if (locount[p] == locount[p-1])
+                continue;
+            const uint64_t cp = locount[p-1];
+            const uint128_t sp = losum[p-1];
+            const uint64_t p2 = p * p;
+            // hi[i] uses hi[i*p] which is updated later, lo[v] uses lo[v/p] which is updated later
+            const uint64_t imax = std::min(r, x / p2);
+            for (uint64_t i = 1; i <= imax; ++i)
+            {
+                const uint64_t d = i * p;
+                if (d <= r)
+                {
+                    hicount[i] -= hicount[d] - cp;
+                    hisum[i] -= p * (hisum[d] - sp);
+                } else {
+                    const uint64_t v = x / d;
+                    hicount[i] -= locount[v] - cp;
+                    hisum[i] -= p * (losum[v] - sp);
+                }
+            }
+            for (uint64_t v = r; v >= p2; --v)
+            {
+                locount[v] -= locount[v/p] - cp;
+                losum[v] -= p * (losum[v/p] - sp);
+            }
+        }
+        return result_t{ hicount[1], hisum[1] };
+    }
+
+    // number and sum of primes in [lb,ub)
+    static result_t count(uint64_t lb, uint64_t ub)
+    {
+        if (ub <= lb)
+            return result_t{ 0, 0 };
+        const result_t a = count(lb == 0 ? 0 : lb - 1), b = count(ub - 1);
+        return result_t{ b.count - a.count, b.sum - a.sum };
+    }
+
+private:
+    static uint64_t _isqrt(uint64_t x)
+    {
+        const uint64_t r = ceil_sqrt(x);
+        return (r > 0 && r > x / r) ? r - 1 : r;
+    }
+    static uint128_t _triangle(uint64_t v)
+    {
+        return uint128_t(v) * (v + 1) / 2;
+    }
+};
+#endif // __SIZEOF_INT128__
+
+// engines to generate, count or sum the primes in a range [lb,ub)
+enum engine_t
+{
+    engine_dense,      // prime_sieve: whole sieve up to ub in memory
+    engine_segmented,  // range_sieve: segments of [lb,ub) with the sieving primes up to sqrt(ub)
+    engine_primality,  // primality_tester: strong probable prime tests of the odd numbers in [lb,ub)
+    engine_analytic,   // prime_counter: only the number and sum of primes
+    engine_count
+};
+
+inline const char* engine_name(unsigned engine)
+{
+    static const char* names[engine_count] = { "dense", "segmented", "primality", "analytic" };
+    return engine < engine_count ? names[engine] : "unknown";
+}
+
+// engine by name, engine_count if unknown
+inline engine_t parse_engine(const std::string& name)
+{
+    for (unsigned e = 0; e < engine_count; ++e)
+        if (name == engine_name(e))
+            return engine_t(e);
+    return engine_count;
+}
+
+// cost model of estimate_engines: rough single core timings in nanoseconds per number, per sieving prime
+// or per x^(3/4) measured with this code, and the memory limits above which an engine is not considered
+struct engine_cost_model_t
+{
+    double dense_per_number = 1.0;
+    double segmented_per_number = 0.6, segmented_per_sievingprime = 15.0, segmented_per_sqrt = 1.7, segmented_setup = 4.0e6;
+    double primality_per_number = 100.0;
+    double analytic_per_x34 = 3.2;
+    uint64_t dense_maxub = uint64_t(1) << 36;          // 4 GiB sieve
+    uint64_t analytic_maxmemory = uint64_t(1) << 30;
+
+    // only the hard limits of each engine, e.g. to force one engine
+    static engine_cost_model_t unlimited()
+    {
+        engine_cost_model_t model;
+        model.dense_maxub = prime_sieve::maxub;
+        model.analytic_maxmemory = ~uint64_t(0);
+        return model;
+    }
+};
+
+// estimated time of each allowed engine for [lb,ub) with a simple cost model and the fastest engine
+struct engine_estimate_t
+{
+    double seconds[engine_count]; // negative if not applicable
+    engine_t engine;
+
+    std::string explain() const
+    {
+        std::string str = std::string("engine=") + engine_name(engine);
+        for (unsigned e = 0; e < engine_count; ++e)
+        {
+            char buf[64];
+            if (seconds[e] < 0)
+                snprintf(buf, sizeof(buf), " %s=n/a", engine_name(e));
+            else
+                snprintf(buf, sizeof(buf), " %s=%.3gs", engine_name(e), seconds[e]);
+            str += buf;
+        }
+        return str;
+    }
+};
+
+// engines is a bit mask of the engines that the caller supports, e.g. only words from dense and segmented
+template<typename Int>
+engine_estimate_t estimate_engines(Int lb, Int ub, unsigned engines = (1u << engine_count) - 1, const engine_cost_model_t& model = engine_cost_model_t())
+{
+    const double len = ub > lb ? double(ub - lb) : 0.0, x = double(ub);
+    const double sqrtx = std::sqrt(x), sievingprimes = sqrtx / std::max(1.0, std::log(sqrtx));
+    engine_estimate_t est;
+    for (auto& s : est.seconds)
+        s = -1;
+    if ((engines & (1u << engine_dense)) && ub <= Int(prime_sieve::maxub) && ub <= Int(model.dense_maxub))
+        est.seconds[engine_dense] = 1.0e-9 * model.dense_per_number * x;
+    if (engines & (1u << engine_segmented))
+        est.seconds[engine_segmented] = 1.0e-9 * (model.segmented_per_number * len + model.segmented_per_sievingprime * sievingprimes
+            + model.segmented_per_sqrt * sqrtx + model.segmented_setup);
+#ifdef __SIZEOF_INT128__
+    if ((engines & (1u << engine_primality)) && ub <= Int(~uint64_t(0)))
+        est.seconds[engine_primality] = 1.0e-9 * model.primality_per_number * len;
+    if ((engines & (1u << engine_analytic)) && ub <= Int(~uint64_t(0)) && prime_counter::memory(uint64_t(ub)) <= model.analytic_maxmemory)
+        est.seconds[engine_analytic] = 1.0e-9 * model.analytic_per_x34 * (std::pow(x, 0.75) + std::pow(double(lb), 0.75));
+#endif
+    est.engine = engine_segmented;
+    for (unsigned e = 0; e < engine_count; ++e)
+        if (est.seconds[e] >= 0 && (est.seconds[est.engine] < 0 || est.seconds[e] < est.seconds[est.engine]))
+            est.engine = engine_t(e);
+    return est;
+}
+
+#ifdef __SIZEOF_INT128__
+// exactly uniform random primes in [lb,ub) by rejection sampling: draw uniform numbers in [lb,ub) and keep the primes
+// the numbers are drawn in batches and their primality is decided per batch in one of two ways:
+// - dense batches: the sorted numbers are grouped per window of the range and each window with samples is sieved
+//   once with a range_sieve that keeps its sieving primes for all windows
+// - sparse batches: all numbers are tested with the primality_tester
+// the primes are returned in the order in which they were drawn, so they are independent and uniform
+class random_prime_sampler
+{
+public:
+    static const uint64_t windownumbers = uint64_t(1) << 20;
+
+    random_prime_sampler(uint64_t lb, uint64_t ub, uint64_t seed, const engine_cost_model_t& model = engine_cost_model_t())
+        : _lb(lb), _ub(ub), _model(model), _rng(seed), _dist(lb, ub == 0 ? 0 : ub - 1)
+    {
+        if (ub <= lb)
+            throw std::runtime_error("random_prime_sampler: empty range");
+        // below 2^64 prime gaps are less than 1550, so only short ranges can be without primes
+        if (ub - lb < 2048)
+        {
+            bool found = false;
+            _pt.genprimes(lb, ub, [&found](uint64_t) { found = true; });
+            if (!found)
+                throw std::runtime_error("random_prime_sampler: no primes in range");
+        }
+    }
+
+    // call callback(p) for count random primes p
+    template<typename F>
+    void sample(size_t count, F&& callback)
+    {
+        const double density = 1.0 / std::max(1.0, std::log(double(_ub)));
+        while (count > 0)
+        {
+            // enough numbers to find all remaining primes in most cases
+            const size_t batch = std::min(size_t(double(count) / density * 1.1) + 64, size_t(1) << 22);
+            _samples.resize(batch);
+            for (auto& n : _samples)
+                n = _dist(_rng);
+            _isprime.assign(batch, 0);
+            if (_sieve_cost(batch) < 1.0e-9 * _model.primality_per_number * double(batch))
+                _sieve_batch();
+            else
+                _pt.test(&_samples[0], batch, &_isprime[0]);
+            for (size_t i = 0; i < batch && count > 0; ++i)
+                if (_isprime[i])
+                {
+                    callback(_samples[i]);
+                    --count;
+                }
+        }
+    }
+
+private:
+    uint64_t _lb, _ub;
+    engine_cost_model_t _model;
+    std::mt19937_64 _rng;
+    std::uniform_int_distribution<uint64_t> _dist;
+    primality_tester _pt;
+    range_sieve _rs;
+    std::vector<uint64_t> _samples;
+    std::vector<uint8_t> _isprime;
+    std::vector<size_t> _order, _windowbegin;
+    std::vector<prime_sieve::word_t> _words;
+
+    // estimated time to sieve all windows hit by batch uniform samples with the segmented costs of the model, see estimate_engines
+    double _sieve_cost(size_t batch) const
+    {
+        const double windows = std::min(double(batch), double(_ub - _lb) / double(windownumbers) + 1);
+        const double len = std::min(double(_ub - _lb), double(windownumbers));
+        const double sqrtx = std::sqrt(double(_ub)), sievingprimes = sqrtx / std::max(1.0, std::log(sqrtx));
+        return 1.0e-9 * (windows * (_model.segmented_per_number * len + _model.segmented_per_sievingprime * sievingprimes)
+            + _model.segmented_per_sqrt * sqrtx);
+    }
+
+    void _sieve_batch()
+    {
+        // counting sort of the samples by window: this path is only taken if there are fewer windows than samples
+        const uint64_t windows = (_ub - _lb - 1) / windownumbers + 1;
+        _windowbegin.assign(size_t(windows) + 1, 0);
+        for (auto n : _samples)
+            ++_windowbegin[size_t((n - _lb) / windownumbers) + 1];
+        for (size_t w = 0; w < windows; ++w)
+            _windowbegin[w+1] += _windowbegin[w];
+        _order.resize(_samples.size());
+        {
+            std::vector<size_t> pos(_windowbegin.begin(), _windowbegin.end() - 1);
+            for (size_t i = 0; i < _samples.size(); ++i)
+                _order[pos[size_t((_samples[i] - _lb) / windownumbers)]++] = i;
+        }
+        // sieve each window with samples once and look up its samples
+        _rs.reserve(_ub);
+        for (size_t w = 0; w < windows; ++w)
+        {
+            if (_windowbegin[w] == _windowbegin[w+1])
+                continue;
+            const uint64_t wlb = _lb + w * windownumbers;
+            const uint64_t wub = _ub - wlb > windownumbers ? wlb + windownumbers : _ub;
+            const uint64_t n0 = (wlb / prime_sieve::wordnumbers) * prime_sieve::wordnumbers + 1;
+            _words.clear();
+            _rs.genwords(wlb, wub, [this](uint64_t, prime_sieve::word_t x) { _words.push_back(x); });
+            for (size_t j = _windowbegin[w]; j < _windowbegin[w+1]; ++j)
+            {
+                const uint64_t m = _samples[_order[j]];
+                if (m == 2)
+                    _isprime[_order[j]] = 1;
+                else if (m % 2 == 1 && m >= n0)
+                    _isprime[_order[j]] = uint8_t((_words[size_t((m - n0) / prime_sieve::wordnumbers)] >> (((m - n0) % prime_sieve::wordnumbers) / 2)) & 1);
+            }
+        }
+    }
+};
+#endif // __SIZEOF_INT128__
+
+// find prime k-tuplets (n+offsets[0], ..., n+offsets[k-1]) in the consecutive sieve words of genwords
+// offsets must be even and increasing with offsets[0] = 0 and offsets[k-1] < wordnumbers
+// tuplets are found with a shift-AND over the current and next word and are only found if all members are in range
+template<typename Int>
+class basic_tuplet_finder
+{
+public:
+    typedef prime_sieve::word_t word_t;
+    static const size_t wordbits = prime_sieve::wordbits;
+    static const size_t wordnumbers = prime_sieve::wordnumbers;
+
+    basic_tuplet_finder(const std::vector<size_t>& offsets)
+        : _count(0), _havelast(false)
+    {
+        if (offsets.empty() || offsets[0] != 0)
+            throw std::runtime_error("basic_tuplet_finder: first offset must be 0");
+        for (size_t i = 1; i < offsets.size(); ++i)
+        {
+            if (offsets[i] % 2 != 0 || offsets[i] <= offsets[i-1] || offsets[i] >= wordnumbers)
+                throw std::runtime_error("basic_tuplet_finder: offsets must be even, increasing and < " + std::to_string(wordnumbers));
+            _shifts.push_back(unsigned(offsets[i] / 2));
+        }
+    }
+
+    // process next word of genwords, for each tuplet found in the previous word call callback(first prime)
+    template<typename F>
+    void operator()(Int n, word_t x, F&& callback)
+    {
+        if (_havelast)
+            _match(x, callback);
+        _lastn = n;
+        _last = x;
+        _havelast = true;
+    }
+    void operator()(Int n, word_t x)
+    {
+        (*this)(n, x, [](Int){});
+    }
+
+    // process the last word after sieving
+    template<typename F>
+    void finish(F&& callback)
+    {
+        if (_havelast)
+            _match(0, callback);
+        _havelast = false;
+    }
+    void finish()
+    {
+        finish([](Int){});
+    }
+
+    size_t count() const { return _count; }
+
+private:
+    template<typename F>
+    inline void _match(word_t next, F& callback)
+    {
+        word_t m = _last;
+        for (auto s : _shifts)
+            m &= (_last >> s) | (next << (wordbits - s));
+        _count += size_t(__builtin_popcountll(m));
+        while (m != 0)
+        {
+            size_t b = __builtin_ctzll(m);
+            m ^= word_t(1)<<b;
+            callback(_lastn + 2*b);
+        }
+    }
+
+    std::vector<unsigned> _shifts;
+    size_t _count;
+    bool _havelast;
+    Int _lastn;
+    word_t _last;
+};
+
+// statistics of gaps between consecutive odd primes from the sieve words of genwords
+// - histogram of all gaps: histogram()[g/2] is the number of gaps of size g
+// - maximal gaps: each gap that is larger than all previous gaps, as pair (prime before gap, gap)
+template<typename Int>
+class basic_gap_statistics
+{
+public:
+    typedef prime_sieve::word_t word_t;
+
+    basic_gap_statistics() : _havelast(false), _maxgap(0) {}
+
+    void operator()(Int n, word_t x)
+    {
+        while (x != 0)
+        {
+            size_t b = __builtin_ctzll(x);
+            x ^= word_t(1)<<b;
+            const Int p = n + 2*b;
+            if (_havelast)
+            {
+                const size_t gap = size_t(p - _last);
+                if (gap/2 >= _histogram.size())
+                    _histogram.resize(gap/2 + 1, 0);
+                ++_histogram[gap/2];
+                if (gap > _maxgap)
+                {
+                    _maxgap = gap;
+                    _records.emplace_back(_last, gap);
+                }
+            }
+            _last = p;
+            _havelast = true;
+        }
+    }
+
+    const std::vector<size_t>& histogram() const { return _histogram; }
+    const std::vector< std::pair<Int, size_t> >& records() const { return _records; }
+
+private:
+    bool _havelast;
+    Int _last;
+    size_t _maxgap;
+    std::vector<size_t> _histogram;
+    std::vector< std::pair<Int, size_t> > _records;
+};
+
+// lock-free bounded ring of slots between one producer and one consumer thread
+// the producer fills producer_slot() and calls publish(), the consumer reads consumer_slot() and calls release()
+// slots are reused, so their memory (e.g. vector capacity) is allocated only once
+template<typename T>
+class spsc_ring
+{
+    std::vector<T> _slots;
+    alignas(64) std::atomic<size_t> _head; // next slot to consume
+    alignas(64) std::atomic<size_t> _tail; // next slot to produce
+    alignas(64) std::atomic<bool> _closed;
+
+public:
+    explicit spsc_ring(size_t slots) : _slots(std::max<size_t>(slots, 2)), _head(0), _tail(0), _closed(false) {}
+
+    // wait for a free slot, returns nullptr if the ring was closed
+    T* producer_slot()
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        while (tail - _head.load(std::memory_order_acquire) == _slots.size())
+        {
+            if (_closed.load(std::memory_order_acquire))
+                return nullptr;
+            std::this_thread::yield();
+        }
+        return &_slots[tail % _slots.size()];
+    }
+    void publish()
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // wait for a filled slot, returns nullptr if the ring was closed and all slots are consumed
+    T* consumer_slot()
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        while (head == _tail.load(std::memory_order_acquire))
+        {
+            if (_closed.load(std::memory_order_acquire) && head == _tail.load(std::memory_order_acquire))
+                return nullptr;
+            std::this_thread::yield();
+        }
+        return &_slots[head % _slots.size()];
+    }
+    void release()
+    {
+        _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // no more slots will be published (producer) or consumed (consumer)
+    void close()
+    {
+        _closed.store(true, std::memory_order_release);
+    }
+};
+
+// pipelined genprimes: sieve.genprimes(lb, ub) runs on a producer thread that passes batches of primes
+// through an spsc_ring to the calling thread, which calls callback(p) for all primes in order
+// throughput is about the maximum instead of the sum of sieving and the callback, memory is bounded by slots*batchsize
+// exceptions of either side stop both sides and are rethrown in the calling thread
+template<typename Sieve, typename Int, typename F>
+void pipelined_genprimes(Sieve& sieve, Int lb, Int ub, F&& callback, size_t batchsize = 1<<14, size_t slots = 8)
+{
+    struct stopped {};
+    spsc_ring<std::vector<Int>> ring(slots);
+    std::exception_ptr error;
+    std::thread producer([&]()
+        {
+            try
+            {
+                std::vector<Int>* batch = ring.producer_slot();
+                if (batch == nullptr)
+                    throw stopped();
+                batch->clear();
+                sieve.genprimes(lb, ub, [&](Int p)
+                    {
+                        batch->push_back(p);
+                        if (batch->size() < batchsize)
+                            return;
+                        ring.publish();
+                        if ((batch = ring.producer_slot()) == nullptr)
+                            throw stopped();
+                        batch->clear();
+                    });
+                if (!batch->empty())
+                    ring.publish();
+            }
+            catch (stopped&) {}
+            catch (...) { error = std::current_exception(); }
+            ring.close();
+        });
+    try
+    {
+        while (std::vector<Int>* batch = ring.consumer_slot())
+        {
+            for (Int p : *batch)
+                callback(p);
+            ring.release();
+        }
+    }
+    catch (...)
+    {
+        ring.close();
+        producer.join();
+        throw;
+    }
+    producer.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// decimal string of increasing numbers p, updated from the previous string using the difference
+template<typename Int>
+struct basic_decimal_formatter
+{
+    static const size_t maxdigits = 3 * sizeof(Int);
+    size_t _printlen;
+    Int _printlast;
+    char _printstr[maxdigits+2];
+    
+    basic_decimal_formatter() : _printlast(~Int(0)) {}
+    
+    // returns null-terminated decimal string of p of length size()
+    const char* operator()(Int p)
+    {
+        // first initialization (and upon any decrease to be generic)
+        if (p < _printlast)
+        {
+            for (size_t i = 0; i < maxdigits; ++i)
+                _printstr[i] = '0';
+            _printstr[maxdigits] = 0;
+            _printlen = 1;
+            _printlast = 0;
+        }
+        // update status
+        Int d = p - _printlast;
+        _printlast = p;
+        // update print string using d
+        size_t i = maxdigits-1;
+        do
+        {
+            d += _printstr[i] - '0';
+            _printstr[i] = '0' + char(d%10);
+            d /= 10;
+            --i;
+        } while (d != 0);
+        // increase print length if needed
+        if (i < maxdigits-1 - _printlen)
+            _printlen = maxdigits-1-i;
+        return _printstr + maxdigits - _printlen;
+    }
+
+    size_t size() const { return _printlen; }
+};
+
+// print prime p
+// lines are collected in a buffer that is written to stdout when full, by flush() and on destruction
+template<typename Int>
+struct basic_printprime
+{
+    static const size_t bufsize = 1<<16;
+    basic_decimal_formatter<Int> _format;
+    std::vector<char> _buf;
+    size_t _buflen;
+
+    basic_printprime() : _buf(bufsize), _buflen(0) {}
+    // copies start with an empty buffer, so that no output is written twice
+    basic_printprime(const basic_printprime& r) : _format(r._format), _buf(bufsize), _buflen(0) {}
+    ~basic_printprime() { flush(); }
+
+    void operator()(Int p)
+    {
+        const char* str = _format(p);
+        const size_t len = _format.size();
+        if (_buflen + len + 1 > bufsize)
+            flush();
+        memcpy(&_buf[_buflen], str, len);
+        _buf[_buflen + len] = '\n';
+        _buflen += len + 1;
+    }
+
+    void flush()
+    {
+        fwrite(&_buf[0], 1, _buflen, stdout);
+        _buflen = 0;
+    }
+};
+
+typedef basic_printprime<size_t> printprime;
+
 } // namespace
 
 #endif
@@ -0,0 +1,80 @@
+/*********************************************************************************\
+*                                                                                 *
+* https://github.com/cr-marcstevens/primegen                                      *
+*                                                                                 *
+* MIT License                                                                     *
+*                                                                                 *
+* Copyright (c) 2021 Marc Stevens                                                 *
+*                                                                                 *
+* Permission is hereby granted, free of charge, to any person obtaining a copy    *
+* of this software and associated documentation files (the "Software"), to deal   *
+* in the Software without restriction, including without limitation the rights    *
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell       *
+* copies of the Software, and to permit persons to whom the Software is           *
+* furnished to do so, subject to the following conditions:                        *
+*                                                                                 *
+* The above copyright notice and this permission notice shall be included in all  *
+* copies or substantial portions of the Software.                                 *
+*                                                                                 *
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR      *
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,        *
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE     *
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER          *
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,   *
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE   *
+* SOFTWARE.                                                                       *
+*                                                                                 *
+\*********************************************************************************/
+
+// unit tests for library behaviour that the command line utilities do not expose
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "primegen.hpp"
+
+namespace pg = primegen;
+
+std::vector<size_t> genprimes(pg::prime_sieve& ps, size_t lb, size_t ub)
+{
+    std::vector<size_t> primes;
+    ps.genprimes(lb, ub, [&](size_t p){ primes.emplace_back(p); });
+    return primes;
+}
+
+void check(bool ok, const std::string& what)
+{
+    if (!ok)
+        throw std::runtime_error("check failed: " + what);
+}
+
+// a persistent prime_sieve that is extended by calls with growing ub must agree with a fresh sieve
+void test_prime_sieve_extend()
+{
+    const size_t ubs[] = { 1, 3, 100, 128, 129, 200, 1000, 5000, 1<<16, 100000, 1<<20, 3000000 };
+    pg::prime_sieve persistent;
+    for (size_t ub : ubs)
+    {
+        pg::prime_sieve fresh;
+        const std::vector<size_t> expected = genprimes(fresh, 0, ub);
+        check(genprimes(persistent, 0, ub) == expected, "prime_sieve extend to " + std::to_string(ub));
+        check(genprimes(persistent, ub/3, ub) == genprimes(fresh, ub/3, ub), "prime_sieve read [ub/3, ub) for " + std::to_string(ub));
+    }
+}
+
+int main()
+{
+    try
+    {
+        test_prime_sieve_extend();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}